@@ -6,6 +6,8 @@
 # It sets the following variables:
 #   FFTW_FOUND               ... true if fftw is found on the system
 #   FFTW_LIBRARIES           ... full path to fftw library
+#   FFTW_THREADS_LIB         ... fftw threads library (OpenMP or pthreads), if it is separate (it is also in
+#                                FFTW_LIBRARIES, before the main library so static linking works)
 #   FFTW_INCLUDES            ... fftw include directory
 #
 # The following variables will be checked by the function
@@ -35,7 +37,7 @@ set( CMAKE_FIND_LIBRARY_SUFFIXES_SAV ${CMAKE_FIND_LIBRARY_SUFFIXES} )
 if( ${FFTW_USE_STATIC_LIBS} )
     set( CMAKE_FIND_LIBRARY_SUFFIXES ${CMAKE_STATIC_LIBRARY_SUFFIX} )
 else()
-    set(CMAKE_FIND_LIBRARY_SUFFIXES ${CMAKE_SHARED_LIBRARY_SUFFIX}${CMAKE_STATIC_LIBRARY_SUFFIX} )
+    set(CMAKE_FIND_LIBRARY_SUFFIXES ${CMAKE_SHARED_LIBRARY_SUFFIX} ${CMAKE_STATIC_LIBRARY_SUFFIX} )
 endif()
 
 if( FFTW_ROOT )
@@ -67,6 +69,14 @@ if( FFTW_ROOT )
             NO_DEFAULT_PATH
     )
 
+    find_library(
+            FFTW_THREADS_LIB
+            NAMES fftw3_omp fftw3_threads
+            PATHS ${FFTW_ROOT}
+            PATH_SUFFIXES "lib" "lib64"
+            NO_DEFAULT_PATH
+    )
+
     #find includes
     find_path(
             FFTW_INCLUDES
@@ -97,6 +107,13 @@ else()
             PATHS ${PKG_FFTW_LIBRARY_DIRS} ${LIB_INSTALL_DIR}
     )
 
+    # fftw_init_threads etc. are in their own library on most Linux installs (the Windows dlls have them built in)
+    find_library(
+            FFTW_THREADS_LIB
+            NAMES fftw3_omp fftw3_threads
+            PATHS ${PKG_FFTW_LIBRARY_DIRS} ${LIB_INSTALL_DIR}
+    )
+
     find_path(
             FFTW_INCLUDES
             NAMES fftw3.h
@@ -107,6 +124,10 @@ endif( FFTW_ROOT )
 
 set(FFTW_LIBRARIES ${FFTW_LIB})
 
+if(FFTW_THREADS_LIB)
+    set(FFTW_LIBRARIES ${FFTW_THREADS_LIB} ${FFTW_LIBRARIES})
+endif()
+
 if(FFTWF_LIB)
     set(FFTW_LIBRARIES ${FFTW_LIBRARIES} ${FFTWF_LIB})
 endif()
@@ -120,4 +141,4 @@ set( CMAKE_FIND_LIBRARY_SUFFIXES ${CMAKE_FIND_LIBRARY_SUFFIXES_SAV} )
 include(FindPackageHandleStandardArgs)
 find_package_handle_standard_args(FFTW DEFAULT_MSG FFTW_INCLUDES FFTW_LIBRARIES)
 
-mark_as_advanced(FFTW_INCLUDES FFTW_LIBRARIES FFTW_LIB FFTWF_LIB FFTWL_LIB)
+mark_as_advanced(FFTW_INCLUDES FFTW_LIBRARIES FFTW_LIB FFTWF_LIB FFTWL_LIB FFTW_THREADS_LIB)
@@ -0,0 +1,698 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <array>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <algorithm>
+#include <functional>
+
+#include <omp.h>
+
+#include "fftw3.h"
+
+#include "gpa.h"
+#include "tiledgpa.h"
+#include "synthetic.h"
+#include "strainpp.h"
+
+// Checks that the different ways of running the engine (the public API, a region of interest, tiles, more g-vectors...)
+// still give the same answer as the plain full frame GPA, and how much each costs. Every configuration is run over a
+// set of synthetic images and its phases and distortion are compared to the full frame results, which are in turn
+// compared to the exact answer the images were made from. Anything over its limits (or slower than it should be
+// compared to the full frame, or to an earlier run given with --baseline) is a failure and the exit code is 1.
+//
+// The errors are only measured away from the image edges (see interior), the edges are never right and each
+// configuration gets them wrong differently
+
+namespace {
+
+    typedef std::map<std::string, std::string> Options;
+
+    const double NotChecked = std::numeric_limits<double>::quiet_NaN();
+
+    void printUsage()
+    {
+        std::cout << "Usage: strainpp-accuracy [options]\n"
+                     "\n"
+                     "  --output FILE          JSON file to write the results to (default: strainpp-accuracy.json)\n"
+                     "  --baseline FILE        results of an earlier run, anything slower or less accurate than that\n"
+                     "                         by more than the tolerances below fails\n"
+                     "  --speed-tolerance F    fraction slower than the baseline that is allowed (default: 0.25)\n"
+                     "  --error-tolerance F    factor by which the errors can grow over the baseline (default: 2)\n"
+                     "  --no-speed             don't fail on any of the speed checks (e.g. on a busy machine)\n"
+                     "  --sizes N,N,...        image sizes (default: 256,512)\n"
+                     "  --noise S,S,...        noise levels, as a fraction of the fringe amplitude (default: 0,0.05)\n"
+                     "  --fields F,F,...       any of uniform, rotation, misfit, dipole (default: all of them)\n"
+                     "  --configs C,C,...      any of full, engine, region, tiled, three-g (default: all of them)\n"
+                     "  --repeats N            timed runs of each, the median is used (default: 3)\n"
+                     "  --threads N            threads for OpenMP and FFTW (default: all of them)\n"
+                     "  --help                 show this message\n";
+    }
+
+    Options parseArguments(int argc, char *argv[])
+    {
+        Options opts;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+
+            if (arg == "-h" || arg == "--help" || arg == "--no-speed")
+            {
+                opts[arg == "--no-speed" ? "no-speed" : "help"] = "true";
+                continue;
+            }
+
+            if (arg.compare(0, 2, "--") != 0)
+                throw std::runtime_error("Unexpected argument: " + arg);
+            else if (i + 1 < argc)
+                opts[arg.substr(2)] = argv[++i];
+            else
+                throw std::runtime_error("Missing value for " + arg);
+        }
+
+        return opts;
+    }
+
+    std::string getOption(const Options &opts, const std::string &key, const std::string &fallback)
+    {
+        auto it = opts.find(key);
+        return it == opts.end() ? fallback : it->second;
+    }
+
+    std::vector<std::string> splitList(const std::string &value)
+    {
+        std::vector<std::string> out;
+        std::stringstream ss(value);
+        std::string item;
+
+        while (std::getline(ss, item, ','))
+            out.push_back(item);
+
+        return out;
+    }
+
+    // Memory from /proc/self/status in MB (Linux only, NaN elsewhere). The peak is reset first where the kernel allows
+    // it so each configuration has its own, otherwise it is the peak of the whole run so far
+    double memoryStatus(const std::string &key)
+    {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+
+        while (std::getline(status, line))
+            if (line.compare(0, key.size() + 1, key + ":") == 0)
+                return std::stod(line.substr(key.size() + 1)) / 1024.0;
+
+        return NotChecked;
+    }
+
+    void resetPeakMemory()
+    {
+        std::ofstream clear("/proc/self/clear_refs");
+        clear << "5";
+    }
+
+    // One run of a configuration, in the engine's orientation. 'area' is the part of the image it gives results for
+    struct Output
+    {
+        ImageRegion area;
+        std::array<Eigen::MatrixXd, 4> distortion;
+
+        // wrapped phases of g1 and g2, empty if the configuration doesn't give them
+        std::vector<Eigen::MatrixXd> phases;
+    };
+
+    // only 'run' is timed, the rest (making the engines and plans) happens once beforehand
+    struct Runner
+    {
+        std::function<void()> run;
+        std::function<Output()> output;
+    };
+
+    struct Case
+    {
+        std::string name;
+        StrainSynthetic::Sample sample;
+        Eigen::MatrixXcd image;
+        double sigma;
+
+        // largest RMS error of the full frame distortion against the exact answer
+        double truthTolerance;
+    };
+
+    struct Config
+    {
+        std::string name;
+        std::function<Runner(const Case&)> prepare;
+
+        // limits against the full frame results: RMS of the distortion, largest phase difference (radians) and time
+        double distortionTolerance, phaseTolerance, speedRatio;
+    };
+
+    ImageRegion wholeImage(const Case &c)
+    {
+        ImageRegion area;
+        area.rows = c.image.rows();
+        area.cols = c.image.cols();
+        return area;
+    }
+
+    Output gpaOutput(GPA &gpa, const ImageRegion &area)
+    {
+        Output out;
+        out.area = area;
+        out.distortion = {*gpa.getExx(), *gpa.getExy(), *gpa.getEyx(), *gpa.getEyy()};
+        for (int k = 0; k < 2; ++k)
+            out.phases.push_back(gpa.getPhase(k)->getWrappedPhase());
+        return out;
+    }
+
+    // a GPA of the whole image with the first 'count' g-vectors, over 'area' if it isn't empty
+    Runner gpaRunner(const Case &c, int count, const ImageRegion &area = ImageRegion())
+    {
+        auto gpa = std::make_shared<GPA>(c.image);
+        gpa->setRegion(area);
+
+        for (int k = 0; k < count; ++k)
+            gpa->calculatePhase(k, c.sample.gVectors[k].x, c.sample.gVectors[k].y, c.sigma);
+
+        ImageRegion outArea = area.empty() ? wholeImage(c) : area;
+
+        Runner runner;
+        runner.run = [gpa, &c]()
+        {
+            gpa->updateImage(c.image);
+            gpa->calculateDistortion(0.0, "Distortion");
+        };
+        runner.output = [gpa, outArea]() {return gpaOutput(*gpa, outArea);};
+        return runner;
+    }
+
+    // The public API takes the image top row first, so it is given the last row of the matrix and a negative stride to
+    // see it the same way round as the GPA. The results come back the other way up
+    Runner engineRunner(const Case &c)
+    {
+        const Eigen::MatrixXd &image = c.sample.images[0];
+        auto rows = image.rows(), cols = image.cols();
+        Strainpp::ImageView view(image.data() + (rows - 1) * cols, rows, cols, -cols);
+
+        auto engine = std::make_shared<Strainpp::Engine>(view);
+        engine->setGVectors(Strainpp::GVector{c.sample.gVectors[0].x, c.sample.gVectors[0].y},
+                            Strainpp::GVector{c.sample.gVectors[1].x, c.sample.gVectors[1].y}, c.sigma);
+
+        auto result = std::make_shared<Strainpp::Result>();
+
+        Runner runner;
+        runner.run = [engine, result, view]()
+        {
+            *result = engine->process(view, 0.0, Strainpp::Mode::Distortion);
+        };
+        runner.output = [result, &c]()
+        {
+            Output out;
+            out.area = wholeImage(c);
+
+            const Strainpp::Image *images[4] = {&result->exx, &result->exy, &result->eyx, &result->eyy};
+            for (int k = 0; k < 4; ++k)
+            {
+                out.distortion[k].resize(images[k]->rows, images[k]->cols);
+                for (Eigen::Index j = 0; j < images[k]->rows; ++j)
+                    for (Eigen::Index i = 0; i < images[k]->cols; ++i)
+                        out.distortion[k](j, i) = images[k]->at(images[k]->rows - 1 - j, i);
+            }
+            return out;
+        };
+        return runner;
+    }
+
+    Runner tiledRunner(const Case &c, int tileSize)
+    {
+        auto rows = c.image.rows(), cols = c.image.cols();
+
+        Coord2D<double> sigma(c.sigma / cols, c.sigma / rows);
+        std::vector<Coord2D<double>> gs;
+        for (int k = 0; k < 2; ++k)
+            gs.emplace_back(c.sample.gVectors[k].x / cols, c.sample.gVectors[k].y / rows);
+
+        auto tiled = std::make_shared<TiledGPA>(rows, cols, tileSize, TiledGPA::SuggestedOverlap(sigma));
+        tiled->setGVectors(gs, sigma);
+
+        auto out = std::make_shared<Output>();
+        out->area = wholeImage(c);
+        for (auto &d : out->distortion)
+            d.resize(rows, cols);
+        out->phases.assign(2, Eigen::MatrixXd(rows, cols));
+
+        Runner runner;
+        runner.run = [tiled, out, &c]()
+        {
+            auto source = [&c](const TiledGPA::Region &area, Eigen::MatrixXcd &tile)
+            {
+                tile = c.image.block(area.row0, area.col0, area.rows, area.cols);
+            };
+
+            // the distortion comes first, then the phases
+            auto sink = [out](const TiledGPA::Region &area, const StrainOutputs::NamedImages &results)
+            {
+                for (int k = 0; k < 6; ++k)
+                {
+                    auto &target = k < 4 ? out->distortion[k] : out->phases[k - 4];
+                    target.block(area.row0, area.col0, area.rows, area.cols) = results[k].second;
+                }
+            };
+
+            tiled->run(source, sink, 0.0, "Distortion", true);
+        };
+        runner.output = [out]() {return *out;};
+        return runner;
+    }
+
+    // only the pixels the image edges don't reach, as a region (clipped to 'area'). The mask spreads them as far as it
+    // does the tile edges, so this is the same distance as the tiles overlap by
+    ImageRegion interior(const Case &c, const ImageRegion &area)
+    {
+        Eigen::Index rows = c.image.rows(), cols = c.image.cols();
+        Eigen::Index my = TiledGPA::SuggestedOverlap(c.sigma / rows);
+        Eigen::Index mx = TiledGPA::SuggestedOverlap(c.sigma / cols);
+
+        ImageRegion in;
+        in.row0 = std::max(my, area.row0);
+        in.col0 = std::max(mx, area.col0);
+        in.rows = std::min(rows - my, area.row0 + area.rows) - in.row0;
+        in.cols = std::min(cols - mx, area.col0 + area.cols) - in.col0;
+        return in;
+    }
+
+    struct Norms
+    {
+        double rms = 0.0, max = 0.0;
+    };
+
+    // 'a' and 'b' cover areaA and areaB of the image, only 'over' is compared. Phases are compared modulo 2 pi
+    Norms compare(const std::vector<const Eigen::MatrixXd*> &a, const ImageRegion &areaA,
+                  const std::vector<const Eigen::MatrixXd*> &b, const ImageRegion &areaB, const ImageRegion &over,
+                  bool phase)
+    {
+        Norms n;
+        double sum = 0.0;
+        std::int64_t count = 0;
+
+        for (size_t k = 0; k < a.size(); ++k)
+            for (Eigen::Index j = over.row0; j < over.row0 + over.rows; ++j)
+                for (Eigen::Index i = over.col0; i < over.col0 + over.cols; ++i)
+                {
+                    double d = (*a[k])(j - areaA.row0, i - areaA.col0) - (*b[k])(j - areaB.row0, i - areaB.col0);
+                    if (phase)
+                        d = std::remainder(d, 2 * PI);
+
+                    sum += d * d;
+                    n.max = std::max(n.max, std::abs(d));
+                    ++count;
+                }
+
+        n.rms = count > 0 ? std::sqrt(sum / count) : 0.0;
+        return n;
+    }
+
+    std::vector<const Eigen::MatrixXd*> pointers(const std::array<Eigen::MatrixXd, 4> &m)
+    {
+        return {&m[0], &m[1], &m[2], &m[3]};
+    }
+
+    std::vector<const Eigen::MatrixXd*> pointers(const std::vector<Eigen::MatrixXd> &m)
+    {
+        std::vector<const Eigen::MatrixXd*> out;
+        for (auto &x : m)
+            out.push_back(&x);
+        return out;
+    }
+
+    Case makeCase(const std::string &field, int size, double noise)
+    {
+        StrainSynthetic::Settings settings;
+        settings.rows = settings.cols = size;
+        settings.noise = noise;
+
+        // the third is only used by the three-g configuration, it makes the lattice less of a special case as well
+        settings.gVectors = {Coord2D<double>(1.0 / 8.0, 0.0), Coord2D<double>(0.0, 1.0 / 10.0),
+                             Coord2D<double>(1.0 / 8.0, 1.0 / 10.0)};
+
+        StrainSynthetic::Field f;
+        double truth;
+
+        if (field == "uniform")
+        {
+            f.exx = 0.01;
+            f.exy = 0.005;
+            f.eyx = -0.004;
+            f.eyy = -0.008;
+            truth = 1e-4;
+        }
+        else if (field == "rotation")
+        {
+            f.type = StrainSynthetic::FieldType::Rotation;
+            f.angle = 2.0;
+            truth = 1e-4;
+        }
+        else if (field == "misfit")
+        {
+            f.type = StrainSynthetic::FieldType::Misfit;
+            f.misfit = 0.02;
+            f.width = 4.0;
+            truth = 5e-3;
+        }
+        else if (field == "dipole")
+        {
+            // the mask blurs the cores far more than anything else, so this is only compared between configurations
+            f.type = StrainSynthetic::FieldType::DislocationDipole;
+            f.separation = size / 4.0;
+            truth = NotChecked;
+        }
+        else
+            throw std::runtime_error("Unknown field: " + field);
+
+        settings.fields.push_back(f);
+
+        std::ostringstream name;
+        name << field << "-" << size;
+        if (noise > 0)
+        {
+            name << "-noise" << noise;
+            truth = NotChecked;
+        }
+
+        Case c;
+        c.name = name.str();
+        c.sample = StrainSynthetic::Generate(settings);
+        c.image = c.sample.images[0].cast<std::complex<double>>();
+        c.sigma = StrainSynthetic::SuggestedSigma(c.sample);
+        c.truthTolerance = truth;
+        return c;
+    }
+
+    // a line of the JSON for each case and configuration, so earlier results can be found again without a parser
+    struct Record
+    {
+        std::string image, config;
+        double seconds = 0, memory = NotChecked, phaseRms = NotChecked, phaseMax = NotChecked;
+        double distortionRms = NotChecked, distortionMax = NotChecked, truthRms = NotChecked;
+        std::vector<std::string> failures;
+
+        std::string json() const
+        {
+            auto number = [](double v)
+            {
+                std::ostringstream out;
+                out << std::setprecision(9);
+                if (std::isfinite(v))
+                    out << v;
+                else
+                    out << "null";
+                return out.str();
+            };
+
+            std::ostringstream out;
+            out << "{\"image\": \"" << image << "\", \"config\": \"" << config << "\", \"seconds\": "
+                << number(seconds) << ", \"peak_mb\": " << number(memory) << ", \"phase_rms\": " << number(phaseRms)
+                << ", \"phase_max\": " << number(phaseMax) << ", \"distortion_rms\": " << number(distortionRms)
+                << ", \"distortion_max\": " << number(distortionMax) << ", \"truth_rms\": " << number(truthRms)
+                << ", \"passed\": " << (failures.empty() ? "true" : "false") << "}";
+            return out.str();
+        }
+    };
+
+    // finds "key": value in one of the lines written above
+    double recordValue(const std::string &line, const std::string &key)
+    {
+        size_t at = line.find("\"" + key + "\": ");
+        if (at == std::string::npos)
+            return NotChecked;
+
+        std::string value = line.substr(at + key.size() + 4);
+        if (value.compare(0, 4, "null") == 0)
+            return NotChecked;
+
+        return std::stod(value);
+    }
+
+    std::string recordText(const std::string &line, const std::string &key)
+    {
+        size_t at = line.find("\"" + key + "\": \"");
+        if (at == std::string::npos)
+            return "";
+
+        size_t start = at + key.size() + 5;
+        return line.substr(start, line.find('"', start) - start);
+    }
+
+    typedef std::map<std::pair<std::string, std::string>, std::string> Baseline;
+
+    Baseline readBaseline(const std::string &path)
+    {
+        std::ifstream file(path);
+        if (!file)
+            throw std::runtime_error("Could not open baseline: " + path);
+
+        Baseline baseline;
+        std::string line;
+        while (std::getline(file, line))
+            if (line.find("\"image\": ") != std::string::npos)
+                baseline[{recordText(line, "image"), recordText(line, "config")}] = line;
+
+        return baseline;
+    }
+
+    std::string format(double v)
+    {
+        std::ostringstream out;
+        out << std::setprecision(3) << v;
+        return out.str();
+    }
+
+    // errors can grow by a factor (with a little absolute room as some of them are 0 to rounding)
+    void checkError(Record &r, const std::string &name, double value, double base, double factor)
+    {
+        if (std::isfinite(value) && std::isfinite(base) && value > base * factor + 1e-12)
+            r.failures.push_back(name + " " + format(value) + " is over " + format(factor) + " x the baseline " +
+                                 format(base));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    try
+    {
+        opts = parseArguments(argc, argv);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    if (opts.count("help"))
+    {
+        printUsage();
+        return 0;
+    }
+
+    fftw_init_threads();
+
+    int result = 0;
+    try
+    {
+        if (opts.count("threads"))
+            omp_set_num_threads(std::stoi(opts.at("threads")));
+        fftw_plan_with_nthreads(omp_get_max_threads());
+
+        int repeats = std::max(1, std::stoi(getOption(opts, "repeats", "3")));
+        bool checkSpeed = !opts.count("no-speed");
+        double speedTolerance = std::stod(getOption(opts, "speed-tolerance", "0.25"));
+        double errorTolerance = std::stod(getOption(opts, "error-tolerance", "2"));
+
+        Baseline baseline;
+        if (opts.count("baseline"))
+            baseline = readBaseline(opts.at("baseline"));
+
+        // The full frame is first as everything else is compared to it. The region and public API do exactly the same
+        // sums so only have rounding errors, the tiles are each windowed and the third g-vector changes the fit (a lot
+        // near the dislocation cores, as its mask blurs them differently)
+        std::vector<Config> configs = {
+            {"full", [](const Case &c) {return gpaRunner(c, 2);}, 0.0, 0.0, 1.0},
+            {"engine", [](const Case &c) {return engineRunner(c);}, 1e-10, NotChecked, 1.5},
+            {"region", [](const Case &c)
+            {
+                ImageRegion area;
+                area.row0 = c.image.rows() / 4;
+                area.col0 = c.image.cols() / 4;
+                area.rows = c.image.rows() / 2;
+                area.cols = c.image.cols() / 2;
+                return gpaRunner(c, 2, area);
+            }, 1e-9, 1e-9, 1.5},
+            {"tiled", [](const Case &c)
+            {
+                return tiledRunner(c, std::max(static_cast<int>(c.image.cols()) / 2, 256));
+            }, 1e-4, 1e-3, 4.0},
+            {"three-g", [](const Case &c) {return gpaRunner(c, 3);}, 0.02, 1e-9, 2.5},
+        };
+
+        std::vector<std::string> wanted = splitList(getOption(opts, "configs", "full,engine,region,tiled,three-g"));
+        if (std::find(wanted.begin(), wanted.end(), "full") == wanted.end())
+            wanted.insert(wanted.begin(), "full");
+
+        for (auto &name : wanted)
+            if (std::none_of(configs.begin(), configs.end(), [&](const Config &c) {return c.name == name;}))
+                throw std::runtime_error("Unknown configuration: " + name);
+
+        std::vector<Record> records;
+
+        std::cout << std::left << std::setw(28) << "image" << std::setw(10) << "config" << std::right << std::setw(12)
+                  << "time" << std::setw(12) << "distortion" << std::setw(12) << "phase" << std::setw(12) << "exact"
+                  << std::endl;
+
+        for (auto &sizeText : splitList(getOption(opts, "sizes", "256,512")))
+            for (auto &noiseText : splitList(getOption(opts, "noise", "0,0.05")))
+                for (auto &field : splitList(getOption(opts, "fields", "uniform,rotation,misfit,dipole")))
+                {
+                    Case c = makeCase(field, std::stoi(sizeText), std::stod(noiseText));
+
+                    Output full;
+                    double fullSeconds = 0.0;
+
+                    for (auto &config : configs)
+                    {
+                        if (std::find(wanted.begin(), wanted.end(), config.name) == wanted.end())
+                            continue;
+
+                        Record r;
+                        r.image = c.name;
+                        r.config = config.name;
+
+                        resetPeakMemory();
+                        double before = memoryStatus("VmRSS");
+
+                        Runner runner = config.prepare(c);
+
+                        std::vector<double> times;
+                        for (int i = 0; i < repeats; ++i)
+                        {
+                            auto start = std::chrono::steady_clock::now();
+                            runner.run();
+                            times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                        }
+
+                        std::sort(times.begin(), times.end());
+                        r.seconds = times[times.size() / 2];
+                        r.memory = memoryStatus("VmHWM") - before;
+
+                        Output out = runner.output();
+
+                        // only the full frame has a limit on this, but it's kept for all of them to compare to later
+                        const auto &s = c.sample;
+                        std::vector<const Eigen::MatrixXd*> truth = {&s.exx, &s.exy, &s.eyx, &s.eyy};
+                        r.truthRms = compare(pointers(out.distortion), out.area, truth, wholeImage(c),
+                                             interior(c, out.area), false).rms;
+
+                        if (config.name == "full")
+                        {
+                            full = out;
+                            fullSeconds = r.seconds;
+
+                            if (std::isfinite(c.truthTolerance) && r.truthRms > c.truthTolerance)
+                                r.failures.push_back("error against the exact answer " + format(r.truthRms) +
+                                                     " is over " + format(c.truthTolerance));
+                        }
+                        else
+                        {
+                            ImageRegion over = interior(c, out.area);
+
+                            auto d = compare(pointers(out.distortion), out.area, pointers(full.distortion), full.area,
+                                             over, false);
+                            r.distortionRms = d.rms;
+                            r.distortionMax = d.max;
+
+                            if (!out.phases.empty())
+                            {
+                                auto p = compare(pointers(out.phases), out.area, pointers(full.phases), full.area,
+                                                 over, true);
+                                r.phaseRms = p.rms;
+                                r.phaseMax = p.max;
+                            }
+
+                            if (r.distortionRms > config.distortionTolerance)
+                                r.failures.push_back("distortion differs from the full frame by " +
+                                                     format(r.distortionRms) + " (limit " +
+                                                     format(config.distortionTolerance) + ")");
+
+                            if (std::isfinite(config.phaseTolerance) && r.phaseMax > config.phaseTolerance)
+                                r.failures.push_back("phase differs from the full frame by " + format(r.phaseMax) +
+                                                     " (limit " + format(config.phaseTolerance) + ")");
+
+                            if (checkSpeed && r.seconds > config.speedRatio * fullSeconds)
+                                r.failures.push_back("took " + format(r.seconds / fullSeconds) +
+                                                     " x the full frame (limit " + format(config.speedRatio) + ")");
+                        }
+
+                        auto base = baseline.find({r.image, r.config});
+                        if (base != baseline.end())
+                        {
+                            const std::string &line = base->second;
+
+                            double seconds = recordValue(line, "seconds");
+                            if (checkSpeed && r.seconds > seconds * (1 + speedTolerance))
+                                r.failures.push_back("took " + format(r.seconds) + " s, the baseline was " +
+                                                     format(seconds) + " s");
+
+                            checkError(r, "distortion error", r.distortionRms, recordValue(line, "distortion_rms"),
+                                       errorTolerance);
+                            checkError(r, "phase error", r.phaseMax, recordValue(line, "phase_max"), errorTolerance);
+                            checkError(r, "error against the exact answer", r.truthRms, recordValue(line, "truth_rms"),
+                                       errorTolerance);
+                        }
+
+                        std::cout << std::left << std::setw(28) << r.image << std::setw(10) << r.config << std::right
+                                  << std::setw(10) << format(r.seconds) << " s" << std::setw(12)
+                                  << format(r.distortionRms) << std::setw(12) << format(r.phaseMax)
+                                  << std::setw(12) << format(r.truthRms) << "  "
+                                  << (r.failures.empty() ? "ok" : "FAILED") << std::endl;
+                        for (auto &f : r.failures)
+                            std::cout << "    " << f << std::endl;
+
+                        records.push_back(r);
+                    }
+                }
+
+        std::string path = getOption(opts, "output", "strainpp-accuracy.json");
+        std::ofstream file(path);
+        file << "{\"threads\": " << omp_get_max_threads() << ", \"repeats\": " << repeats << ", \"results\": [";
+        for (size_t i = 0; i < records.size(); ++i)
+            file << (i > 0 ? ",\n" : "\n") << "  " << records[i].json();
+        file << "\n]}\n";
+        if (!file)
+            throw std::runtime_error("Could not write " + path);
+
+        size_t failed = std::count_if(records.begin(), records.end(), [](const Record &r) {return !r.failures.empty();});
+        std::cout << records.size() - failed << " passed, " << failed << " failed" << std::endl;
+
+        if (failed > 0)
+            result = 1;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        result = 1;
+    }
+
+    fftw_cleanup_threads();
+
+    return result;
+}
@@ -0,0 +1,483 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+
+#include <omp.h>
+
+#include "fftw3.h"
+#include "tiffio.h"
+
+#include "gpa.h"
+#include "windows.h"
+#include "outputs.h"
+#include "synthetic.h"
+#include "imageio.h"
+#include "stats.h"
+
+// Benchmarks for the slow parts of the engine (micro) and for whole frames at different image sizes (end to end). Each
+// one is run a few times and the spread is kept as well as the typical time, the results go to JSON so they can be
+// compared between builds. Only the part being measured is timed, anything needed to get it ready (e.g. throwing away
+// the cached results so they are worked out again) is done before the clock starts
+
+namespace {
+
+    typedef std::map<std::string, std::string> Options;
+
+    void printUsage()
+    {
+        std::cout << "Usage: strainpp-bench [options]\n"
+                     "\n"
+                     "  --output FILE          JSON file to write the results to (default: strainpp-bench.json)\n"
+                     "  --size N               image size for the micro benchmarks (default: 1024)\n"
+                     "  --sizes N,N,...        image sizes for the end to end frames (default: 512,1024,2048,4096,8192)\n"
+                     "  --repeats N            number of timed runs of each benchmark (default: 5)\n"
+                     "  --warmup N             untimed runs before those (default: 1)\n"
+                     "  --threads N            threads for OpenMP and FFTW (default: all of them)\n"
+                     "  --filter TEXT          only run the benchmarks with TEXT in their name\n"
+                     "  --tiff FILE            tiff to time reading (default: one written for the purpose)\n"
+                     "  --dm FILE              DM file to time reading (skipped if not given)\n"
+                     "  --help                 show this message\n";
+    }
+
+    Options parseArguments(int argc, char *argv[])
+    {
+        Options opts;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+
+            if (arg == "-h" || arg == "--help")
+            {
+                opts["help"] = "true";
+                continue;
+            }
+
+            if (arg.compare(0, 2, "--") != 0)
+                throw std::runtime_error("Unexpected argument: " + arg);
+            else if (i + 1 < argc)
+                opts[arg.substr(2)] = argv[++i];
+            else
+                throw std::runtime_error("Missing value for " + arg);
+        }
+
+        return opts;
+    }
+
+    std::string getOption(const Options &opts, const std::string &key, const std::string &fallback)
+    {
+        auto it = opts.find(key);
+        return it == opts.end() ? fallback : it->second;
+    }
+
+    std::vector<int> parseSizes(const std::string &value)
+    {
+        std::vector<int> out;
+        std::stringstream ss(value);
+        std::string item;
+
+        while (std::getline(ss, item, ','))
+            out.push_back(std::stoi(item));
+
+        for (int n : out)
+            if (n < 16)
+                throw std::runtime_error("Image sizes must be at least 16");
+
+        return out;
+    }
+
+    // a noisy lattice with a pair of dislocations in the middle, the slices are moved a little from each other so each
+    // frame of a run is different. The reference isn't needed here and would only use up memory at the bigger sizes
+    StrainSynthetic::Sample testImages(int n, int depth = 1)
+    {
+        StrainSynthetic::Settings settings;
+        settings.rows = settings.cols = n;
+        settings.depth = depth;
+        settings.drift = 0.5;
+        settings.noise = 0.1;
+        settings.reference = false;
+
+        StrainSynthetic::Field dipole;
+        dipole.type = StrainSynthetic::FieldType::DislocationDipole;
+        dipole.separation = n / 4.0;
+        settings.fields.push_back(dipole);
+
+        return StrainSynthetic::Generate(settings);
+    }
+
+    void setPhases(GPA &gpa, const StrainSynthetic::Sample &sample)
+    {
+        double sigma = StrainSynthetic::SuggestedSigma(sample);
+        for (int k = 0; k < static_cast<int>(sample.gVectors.size()); ++k)
+            gpa.calculatePhase(k, sample.gVectors[k].x, sample.gVectors[k].y, sigma);
+
+        gpa.computePhases();
+    }
+
+    struct Result
+    {
+        std::string name;
+        int rows, cols;
+
+        // seconds for each timed run
+        std::vector<double> times;
+
+        // work done by each run, the frames per second for the end to end runs
+        int frames = 0;
+
+        double min() const {return *std::min_element(times.begin(), times.end());}
+        double max() const {return *std::max_element(times.begin(), times.end());}
+        double mean() const {return std::accumulate(times.begin(), times.end(), 0.0) / times.size();}
+
+        double median() const
+        {
+            auto t = times;
+            std::sort(t.begin(), t.end());
+            size_t n = t.size();
+            return n % 2 ? t[n / 2] : 0.5 * (t[n / 2 - 1] + t[n / 2]);
+        }
+
+        // sample standard deviation, 0 for a single run
+        double stddev() const
+        {
+            if (times.size() < 2)
+                return 0.0;
+
+            double m = mean();
+            double sum = 0.0;
+            for (double t : times)
+                sum += (t - m) * (t - m);
+            return std::sqrt(sum / (times.size() - 1));
+        }
+    };
+
+    struct Skipped
+    {
+        std::string name;
+        std::string reason;
+    };
+
+    class Bench
+    {
+    public:
+        Bench(int warmup, int repeats, std::string filter) : _Warmup(warmup), _Repeats(repeats),
+                                                             _Filter(std::move(filter)) {}
+
+        bool wanted(const std::string &name) const
+        {
+            return _Filter.empty() || name.find(_Filter) != std::string::npos;
+        }
+
+        // 'setup' is run before every run (timed or not) and isn't timed itself
+        void run(const std::string &name, int rows, int cols, const std::function<void()> &setup,
+                 const std::function<void()> &body, int frames = 0)
+        {
+            if (!wanted(name))
+                return;
+
+            Result result;
+            result.name = name;
+            result.rows = rows;
+            result.cols = cols;
+            result.frames = frames;
+
+            try
+            {
+                for (int i = 0; i < _Warmup + _Repeats; ++i)
+                {
+                    if (setup)
+                        setup();
+
+                    auto start = std::chrono::steady_clock::now();
+                    body();
+                    auto end = std::chrono::steady_clock::now();
+
+                    if (i >= _Warmup)
+                        result.times.push_back(std::chrono::duration<double>(end - start).count());
+                }
+            }
+            catch (const std::bad_alloc&)
+            {
+                skip(name + " " + std::to_string(rows) + "x" + std::to_string(cols), "out of memory");
+                return;
+            }
+
+            report(result);
+            _Results.push_back(result);
+        }
+
+        void skip(const std::string &name, const std::string &reason)
+        {
+            if (!wanted(name))
+                return;
+
+            std::cout << std::left << std::setw(24) << name << "skipped (" << reason << ")" << std::endl;
+            _Skipped.push_back(Skipped{name, reason});
+        }
+
+        std::string json() const
+        {
+            std::ostringstream out;
+            out << std::setprecision(9);
+            out << "{\n  \"threads\": " << omp_get_max_threads() << ",\n  \"warmup\": " << _Warmup
+                << ",\n  \"repeats\": " << _Repeats << ",\n  \"benchmarks\": [";
+
+            for (size_t i = 0; i < _Results.size(); ++i)
+            {
+                const Result &r = _Results[i];
+                out << (i > 0 ? ",\n" : "\n") << "    {\"name\": " << UtilsStats::JsonString(r.name)
+                    << ", \"rows\": " << r.rows << ", \"cols\": " << r.cols << ", \"runs\": " << r.times.size()
+                    << ", \"min\": " << r.min() << ", \"median\": " << r.median() << ", \"mean\": " << r.mean()
+                    << ", \"stddev\": " << r.stddev() << ", \"max\": " << r.max();
+                if (r.frames > 0)
+                    out << ", \"fps\": " << r.frames / r.median();
+                out << "}";
+            }
+
+            out << "\n  ],\n  \"skipped\": [";
+            for (size_t i = 0; i < _Skipped.size(); ++i)
+                out << (i > 0 ? ",\n" : "\n") << "    {\"name\": " << UtilsStats::JsonString(_Skipped[i].name)
+                    << ", \"reason\": " << UtilsStats::JsonString(_Skipped[i].reason) << "}";
+            out << "\n  ]\n}\n";
+
+            return out.str();
+        }
+
+    private:
+        void report(const Result &r)
+        {
+            std::ostringstream size;
+            size << r.rows << "x" << r.cols;
+
+            std::cout << std::left << std::setw(24) << r.name << std::setw(12) << size.str() << std::right
+                      << std::fixed << std::setprecision(3) << std::setw(12) << 1e3 * r.median()
+                      << std::setw(12) << 1e3 * r.min() << std::setw(12) << 1e3 * r.stddev();
+            if (r.frames > 0)
+                std::cout << std::setprecision(2) << std::setw(10) << r.frames / r.median() << " fps";
+            std::cout << std::endl;
+        }
+
+        int _Warmup, _Repeats;
+        std::string _Filter;
+
+        std::vector<Result> _Results;
+        std::vector<Skipped> _Skipped;
+    };
+
+    void microBenchmarks(Bench &bench, int n, const Options &opts)
+    {
+        auto sample = testImages(n);
+        Eigen::MatrixXcd image = sample.images[0].cast<std::complex<double>>();
+        Eigen::MatrixXcd out;
+
+        // FFTW_ESTIMATE planning, this doesn't keep any wisdom so each plan is made from scratch
+        bench.run("fft.plan", n, n, nullptr, [&]()
+        {
+            UtilsFFT::MakePlan(n, n, FFTW_FORWARD);
+        });
+
+        auto plan = UtilsFFT::MakePlan(n, n, FFTW_FORWARD);
+        bench.run("fft.execute", n, n, nullptr, [&]()
+        {
+            UtilsFFT::doFFTPlan(plan, image, out, FFTW_FORWARD);
+        });
+
+        bench.run("fft.pre_shift", n, n, nullptr, [&]()
+        {
+            out = UtilsFFT::preFFTShift(image);
+        });
+
+        UtilsWindow::Window hann(UtilsWindow::WindowType::Hann);
+        bench.run("window.hann", n, n, nullptr, [&]()
+        {
+            UtilsWindow::Apply(hann, image, out);
+        });
+
+        // no phases yet, so new images only redo the FFT (and throw away the power spectrum)
+        GPA gpa(image);
+        bench.run("gpa.g_vectors", n, n, [&]() {gpa.updateImage(image);}, [&]()
+        {
+            gpa.getGVectors();
+        });
+
+        setPhases(gpa, sample);
+
+        auto phase = gpa.getPhase(0);
+        auto fft = gpa.getFFT();
+
+        // the phase keeps everything it works out, giving it the FFT again throws all that away
+        auto invalidate = [&]() {phase->updateFFT(fft);};
+
+        bench.run("phase.gaussian_mask", n, n, nullptr, [&]()
+        {
+            phase->getGaussianMask();
+        });
+
+        bench.run("phase.raw_phase", n, n, invalidate, [&]()
+        {
+            phase->getRawPhase();
+        });
+
+        bench.run("phase.wrapped_phase", n, n, invalidate, [&]()
+        {
+            phase->getWrappedPhase();
+        });
+
+        Eigen::MatrixXcd dx, dy;
+        bench.run("phase.differential", n, n, [&]() {invalidate(); phase->getWrappedPhase();}, [&]()
+        {
+            phase->getDifferential(dx, dy);
+        });
+
+        // always refined from the same starting point, the middle half of the image
+        auto g = phase->getGVectorPixels();
+        bench.run("phase.refine", n, n, [&]() {phase->setGVectorPixels(g.x, g.y); phase->getWrappedPhase();}, [&]()
+        {
+            phase->refinePhase(3 * n / 4, n / 4, n / 4, 3 * n / 4);
+        });
+        phase->setGVectorPixels(g.x, g.y);
+
+        // a new image means the phases have to be worked out again, this is only the differentials and distortion
+        bench.run("gpa.distortion", n, n, [&]() {gpa.updateImage(image);}, [&]()
+        {
+            gpa.calculateDistortion(0.0, "Distortion");
+        });
+
+        // the reading includes opening the file, which is how it's done for real
+        std::string tiffPath = getOption(opts, "tiff", "");
+        bool tempTiff = tiffPath.empty();
+        if (tempTiff && bench.wanted("io.tiff_read"))
+        {
+            tiffPath = (std::filesystem::temp_directory_path() / "strainpp-bench.tif").string();
+            UtilsIO::WriteTiffData(tiffPath, image.real());
+        }
+
+        bench.run("io.tiff_read", n, n, nullptr, [&]()
+        {
+            TIFF *tif = TIFFOpen(tiffPath.c_str(), "r");
+            auto frames = UtilsIO::ReadTiff(tif);
+            TIFFClose(tif);
+        });
+
+        if (tempTiff && !tiffPath.empty())
+            std::remove(tiffPath.c_str());
+
+        if (opts.count("dm"))
+        {
+            std::string dmPath = opts.at("dm");
+            bench.run("io.dm_read", 0, 0, nullptr, [&]()
+            {
+                DMRead::DMReader dmFile(dmPath);
+                auto frames = UtilsIO::ReadDM(dmFile);
+            });
+        }
+        else
+            bench.skip("io.dm_read", "no --dm file given");
+    }
+
+    // The same as the command line does for each slice of a stack: a new image, the phases, the distortion and the
+    // results copied out. Frames alternate between two slices so nothing is ever cached
+    void frameBenchmark(Bench &bench, int n)
+    {
+        std::string name = "frame." + std::to_string(n);
+        if (!bench.wanted(name))
+            return;
+
+        try
+        {
+            auto sample = testImages(n, 2);
+            const auto &frames = sample.images;
+
+            GPA gpa(frames[0].data(), n, n, n);
+            setPhases(gpa, sample);
+
+            size_t next = 1;
+            bench.run(name, n, n, nullptr, [&]()
+            {
+                gpa.updateImage(frames[next++ % frames.size()].data(), n, n, n);
+                gpa.calculateDistortion(0.0, "Distortion");
+                StrainOutputs::Collect(gpa, "Distortion", false);
+            }, 1);
+        }
+        catch (const std::bad_alloc&)
+        {
+            bench.skip(name, "out of memory");
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    try
+    {
+        opts = parseArguments(argc, argv);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    if (opts.count("help"))
+    {
+        printUsage();
+        return 0;
+    }
+
+    fftw_init_threads();
+
+    int result = 0;
+    try
+    {
+        if (opts.count("threads"))
+            omp_set_num_threads(std::stoi(opts.at("threads")));
+        fftw_plan_with_nthreads(omp_get_max_threads());
+
+        int repeats = std::stoi(getOption(opts, "repeats", "5"));
+        int warmup = std::stoi(getOption(opts, "warmup", "1"));
+        if (repeats < 1 || warmup < 0)
+            throw std::runtime_error("Need at least one repeat (and no negative warmup)");
+
+        int size = parseSizes(getOption(opts, "size", "1024")).at(0);
+        auto sizes = parseSizes(getOption(opts, "sizes", "512,1024,2048,4096,8192"));
+
+        Bench bench(warmup, repeats, getOption(opts, "filter", ""));
+
+        std::cout << std::left << std::setw(24) << "name" << std::setw(12) << "size" << std::right << std::setw(12)
+                  << "median (ms)" << std::setw(12) << "min (ms)" << std::setw(12) << "stddev (ms)" << std::endl;
+
+        microBenchmarks(bench, size, opts);
+
+        for (int n : sizes)
+            frameBenchmark(bench, n);
+
+        std::string path = getOption(opts, "output", "strainpp-bench.json");
+        std::ofstream file(path);
+        file << bench.json();
+        if (!file)
+            throw std::runtime_error("Could not write " + path);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        result = 1;
+    }
+
+    fftw_cleanup_threads();
+
+    return result;
+}
@@ -0,0 +1,315 @@
+#include "strainpp.h"
+
+#include <limits>
+#include <stdexcept>
+
+#include "gpa.h"
+
+namespace Strainpp {
+
+    namespace {
+
+        void checkView(const ImageView &view)
+        {
+            if (view.data == nullptr)
+                throw std::invalid_argument("Image has no data");
+
+            if (view.rows < 3 || view.cols < 3)
+                throw std::invalid_argument("Image too small.");
+
+            // the number of pixels can be more than an int holds, but each side has to fit (FFTW and the GPA use int)
+            if (view.rows > std::numeric_limits<int>::max() - 2 || view.cols > std::numeric_limits<int>::max() - 2)
+                throw std::invalid_argument("Image dimensions are too large");
+        }
+
+        // the engine has the first row at the bottom (as it is plotted), so this gives it the last row of the view and
+        // a negative stride. That way the flip happens as the engine reads the data instead of needing a copy
+        template <typename T>
+        const T *bottomRow(const ImageView &view)
+        {
+            return static_cast<const T*>(view.data) + (view.rows - 1) * view.stride();
+        }
+
+        // calls 'use' with a pointer of the right type to the bottom row of the view
+        template <typename Function>
+        void dispatchView(const ImageView &view, Function use)
+        {
+            checkView(view);
+
+            switch (view.type)
+            {
+                case ElementType::UInt8: use(bottomRow<std::uint8_t>(view)); break;
+                case ElementType::UInt16: use(bottomRow<std::uint16_t>(view)); break;
+                case ElementType::UInt32: use(bottomRow<std::uint32_t>(view)); break;
+                case ElementType::UInt64: use(bottomRow<std::uint64_t>(view)); break;
+                case ElementType::Int8: use(bottomRow<std::int8_t>(view)); break;
+                case ElementType::Int16: use(bottomRow<std::int16_t>(view)); break;
+                case ElementType::Int32: use(bottomRow<std::int32_t>(view)); break;
+                case ElementType::Int64: use(bottomRow<std::int64_t>(view)); break;
+                case ElementType::Float32: use(bottomRow<float>(view)); break;
+                case ElementType::Float64: use(bottomRow<double>(view)); break;
+            }
+        }
+
+        // flips back to the orientation of the input
+        Image toImage(const Eigen::MatrixXd &data)
+        {
+            Image out;
+            out.rows = data.rows();
+            out.cols = data.cols();
+            out.data.resize(data.size());
+
+            #pragma omp parallel for
+            for (std::int64_t j = 0; j < out.rows; ++j)
+                for (std::int64_t i = 0; i < out.cols; ++i)
+                    out.data[j * out.cols + i] = data(out.rows - 1 - j, i);
+
+            return out;
+        }
+    }
+
+    std::string modeName(Mode mode)
+    {
+        switch (mode)
+        {
+            case Mode::Strain: return "Strain";
+            case Mode::Rotation: return "Rotation";
+            case Mode::Dilitation: return "Dilitation";
+            default: return "Distortion";
+        }
+    }
+
+    struct Engine::Impl
+    {
+        std::unique_ptr<GPA> gpa;
+
+        bool haveGVectors = false;
+    };
+
+    Engine::Engine(const ImageView &reference) : _Impl(std::make_unique<Impl>())
+    {
+        dispatchView(reference, [&](auto data)
+        {
+            _Impl->gpa = std::make_unique<GPA>(data, static_cast<int>(reference.rows), static_cast<int>(reference.cols),
+                                               -reference.stride());
+        });
+    }
+
+    Engine::~Engine() = default;
+
+    Engine::Engine(Engine &&other) noexcept = default;
+
+    Engine &Engine::operator=(Engine &&other) noexcept = default;
+
+    Engine::Impl &Engine::impl() const
+    {
+        if (!_Impl)
+            throw std::logic_error("Engine has been moved from");
+
+        return *_Impl;
+    }
+
+    std::int64_t Engine::rows() const
+    {
+        return impl().gpa->getSize().y;
+    }
+
+    std::int64_t Engine::cols() const
+    {
+        return impl().gpa->getSize().x;
+    }
+
+    void Engine::setHann(bool hann)
+    {
+        impl().gpa->setDoHann(hann);
+    }
+
+    void Engine::setWindow(WindowType type, double parameter)
+    {
+        UtilsWindow::WindowType t;
+        switch (type)
+        {
+            case WindowType::None: t = UtilsWindow::WindowType::None; break;
+            case WindowType::Tukey: t = UtilsWindow::WindowType::Tukey; break;
+            case WindowType::Blackman: t = UtilsWindow::WindowType::Blackman; break;
+            case WindowType::EdgeSmooth: t = UtilsWindow::WindowType::EdgeSmooth; break;
+            default: t = UtilsWindow::WindowType::Hann; break;
+        }
+
+        impl().gpa->setWindow(UtilsWindow::Window(t, parameter));
+    }
+
+    int Engine::estimateMaskSize()
+    {
+        return impl().gpa->getGVectors();
+    }
+
+    void Engine::findGVectors(double minRadius, GVector &g1, GVector &g2)
+    {
+        Coord2D<double> p1(0, 0), p2(0, 0);
+        impl().gpa->findGVectors(minRadius, p1, p2);
+
+        g1.x = p1.x;
+        g1.y = p1.y;
+        g2.x = p2.x;
+        g2.y = p2.y;
+    }
+
+    void Engine::setGVectors(const GVector &g1, const GVector &g2, double sigma)
+    {
+        setGVectors(std::vector<GVector>{g1, g2}, sigma);
+    }
+
+    void Engine::setGVectors(const std::vector<GVector> &gs, double sigma)
+    {
+        if (sigma <= 0)
+            throw std::invalid_argument("Mask sigma must be positive");
+
+        if (gs.size() < 2)
+            throw std::invalid_argument("At least two g-vectors are needed");
+
+        // existing phases are reused (and keep their results if they haven't changed), but don't leave any from a
+        // previous longer set
+        if (static_cast<int>(gs.size()) < impl().gpa->getPhaseCount())
+            impl().gpa->clearPhases();
+
+        // the phases share the plans made by the GPA, so this doesn't make any plans
+        for (int i = 0; i < static_cast<int>(gs.size()); ++i)
+            impl().gpa->calculatePhase(i, gs[i].x, gs[i].y, sigma);
+
+        impl().gpa->computePhases();
+
+        impl().haveGVectors = true;
+    }
+
+    int Engine::gVectorCount() const
+    {
+        return impl().haveGVectors ? impl().gpa->getPhaseCount() : 0;
+    }
+
+    void Engine::checkGVector(int index) const
+    {
+        if (!impl().haveGVectors)
+            throw std::logic_error("g-vectors have not been set");
+
+        if (index < 0 || index >= gVectorCount())
+            throw std::out_of_range("g-vector index is out of range");
+    }
+
+    void Engine::toMatrixArea(const Region &area, int &t, int &l, int &b, int &r) const
+    {
+        // same conversion as the GUI, from the centred coordinates to the matrix indices
+        auto size = impl().gpa->getSize();
+        int rowmid = size.y / 2;
+        int colmid = size.x / 2;
+
+        t = static_cast<int>(std::max(area.top, area.bottom)) + rowmid;
+        b = static_cast<int>(std::min(area.top, area.bottom)) + rowmid;
+        l = static_cast<int>(std::min(area.left, area.right)) + colmid;
+        r = static_cast<int>(std::max(area.left, area.right)) + colmid;
+
+        if (b < 0 || l < 0 || t > size.y || r > size.x || t - b < 2 || r - l < 2)
+            throw std::out_of_range("Area is outside the image");
+    }
+
+    GVector Engine::refineGVector(int index, const Region &area, int repeats, bool weighted)
+    {
+        checkGVector(index);
+
+        int t, l, b, r;
+        toMatrixArea(area, t, l, b, r);
+
+        auto phase = impl().gpa->getPhase(index);
+        for (int i = 0; i < repeats; ++i)
+        {
+            phase->refinePhase(t, l, b, r, weighted);
+            phase->getWrappedPhase();
+        }
+
+        return getGVector(index);
+    }
+
+    RefineReport Engine::refineGVectorUntilConverged(int index, const Region &area, double tolerance,
+                                                     int maxIterations, bool weighted)
+    {
+        checkGVector(index);
+
+        int t, l, b, r;
+        toMatrixArea(area, t, l, b, r);
+
+        auto report = impl().gpa->getPhase(index)->refineUntilConverged(t, l, b, r, tolerance, maxIterations, weighted);
+
+        RefineReport out;
+        out.g = getGVector(index);
+        out.iterations = report.iterations;
+        out.change = report.change;
+        out.seconds = report.seconds;
+        out.converged = report.converged;
+        return out;
+    }
+
+    GVector Engine::getGVector(int index) const
+    {
+        checkGVector(index);
+
+        auto g = impl().gpa->getPhase(index)->getGVectorPixels();
+
+        GVector out;
+        out.x = g.x;
+        out.y = g.y;
+        return out;
+    }
+
+    void Engine::setRegionOfInterest(const Region &area)
+    {
+        int t, l, b, r;
+        toMatrixArea(area, t, l, b, r);
+
+        ImageRegion region;
+        region.row0 = b;
+        region.col0 = l;
+        region.rows = t - b;
+        region.cols = r - l;
+        impl().gpa->setRegion(region);
+    }
+
+    void Engine::clearRegionOfInterest()
+    {
+        impl().gpa->setRegion(ImageRegion());
+    }
+
+    void Engine::setImage(const ImageView &image)
+    {
+        if (image.rows != rows() || image.cols != cols())
+            throw std::invalid_argument("Image must be the same size as the reference");
+
+        dispatchView(image, [&](auto data)
+        {
+            impl().gpa->updateImage(data, static_cast<int>(image.rows), static_cast<int>(image.cols), -image.stride());
+        });
+    }
+
+    Result Engine::process(double angle, Mode mode)
+    {
+        if (!impl().haveGVectors)
+            throw std::logic_error("g-vectors must be set before processing");
+
+        impl().gpa->calculateDistortion(angle, modeName(mode));
+
+        Result out;
+        out.exx = toImage(*impl().gpa->getExx());
+        out.exy = toImage(*impl().gpa->getExy());
+        out.eyx = toImage(*impl().gpa->getEyx());
+        out.eyy = toImage(*impl().gpa->getEyy());
+        out.g1 = getGVector(0);
+        out.g2 = getGVector(1);
+
+        return out;
+    }
+
+    Result Engine::process(const ImageView &image, double angle, Mode mode)
+    {
+        setImage(image);
+        return process(angle, mode);
+    }
+}
@@ -0,0 +1,194 @@
+#ifndef STRAINPP_H
+#define STRAINPP_H
+
+// Public interface to the strain engine (libstrainpp).
+//
+// This is all that is needed to use the engine from another program, nothing from Eigen or FFTW is exposed so it can
+// be used without them. Coordinates are the same as the GUI: relative to the centre of the image (or FFT) in pixels,
+// with y going up the image.
+//
+// Creating an Engine makes FFTW plans. Every plan the library makes is done under one lock, so engines can be created
+// from any thread as long as nothing else in the program uses FFTW's planner at the same time. A single engine must
+// only be used from one thread at a time.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+namespace Strainpp {
+
+    enum class ElementType { UInt8, UInt16, UInt32, UInt64, Int8, Int16, Int32, Int64, Float32, Float64 };
+
+    template <typename T>
+    constexpr ElementType elementTypeOf()
+    {
+        static_assert(std::is_arithmetic<T>::value, "Image data must be a basic numeric type");
+
+        if (std::is_floating_point<T>::value)
+            return sizeof(T) == 4 ? ElementType::Float32 : ElementType::Float64;
+        else if (std::is_signed<T>::value)
+            return sizeof(T) == 1 ? ElementType::Int8 : sizeof(T) == 2 ? ElementType::Int16 :
+                   sizeof(T) == 4 ? ElementType::Int32 : ElementType::Int64;
+        else
+            return sizeof(T) == 1 ? ElementType::UInt8 : sizeof(T) == 2 ? ElementType::UInt16 :
+                   sizeof(T) == 4 ? ElementType::UInt32 : ElementType::UInt64;
+    }
+
+    // Non-owning view of an image in the caller's memory. Rows are stored one after the other with the first row being
+    // the top of the image (as in image files). The stride is the distance between rows in elements (0 means the rows
+    // are packed), a negative stride can be used for images stored bottom row first.
+    struct ImageView
+    {
+        const void *data = nullptr;
+        std::int64_t rows = 0;
+        std::int64_t cols = 0;
+        std::int64_t rowStride = 0;
+        ElementType type = ElementType::Float64;
+
+        ImageView() = default;
+
+        template <typename T>
+        ImageView(const T *ptr, std::int64_t nRows, std::int64_t nCols, std::int64_t stride = 0)
+                : data(ptr), rows(nRows), cols(nCols), rowStride(stride), type(elementTypeOf<T>()) {}
+
+        std::int64_t stride() const {return rowStride == 0 ? cols : rowStride;}
+    };
+
+    // Owned output image, same layout and orientation as the input view (packed rows, first row is the top)
+    struct Image
+    {
+        std::int64_t rows = 0;
+        std::int64_t cols = 0;
+        std::vector<double> data;
+
+        double at(std::int64_t row, std::int64_t col) const {return data[row*cols + col];}
+    };
+
+    struct GVector
+    {
+        double x = 0;
+        double y = 0;
+    };
+
+    // area for refining g-vectors, in image pixels (the same as selecting it on the phase in the GUI)
+    struct Region
+    {
+        double top = 0;
+        double left = 0;
+        double bottom = 0;
+        double right = 0;
+    };
+
+    struct RefineReport
+    {
+        GVector g;
+        int iterations = 0;
+        // size of the last change to the g-vector (FFT pixels)
+        double change = 0;
+        double seconds = 0;
+        bool converged = false;
+    };
+
+    enum class Mode { Distortion, Strain, Rotation, Dilitation };
+
+    // Tukey takes the fraction of the image that is tapered, EdgeSmooth the width of the taper in pixels
+    enum class WindowType { None, Hann, Tukey, Blackman, EdgeSmooth };
+
+    // What each image holds depends on the mode (as in the GUI):
+    //   Distortion: exx, exy, eyx, eyy
+    //   Strain:     the symmetric strain (exy == eyx)
+    //   Rotation:   exy and eyx hold the rotation, exx and eyy are zero
+    //   Dilitation: exx holds the dilitation, the others are zero
+    struct Result
+    {
+        Image exx, exy, eyx, eyy;
+        GVector g1, g2;
+    };
+
+    class Engine
+    {
+    public:
+        // the reference image sets the size of all images given to this engine
+        explicit Engine(const ImageView &reference);
+
+        ~Engine();
+
+        // a moved-from engine can only be destroyed or assigned to, anything else throws std::logic_error
+        Engine(Engine &&other) noexcept;
+        Engine &operator=(Engine &&other) noexcept;
+
+        Engine(const Engine &) = delete;
+        Engine &operator=(const Engine &) = delete;
+
+        std::int64_t rows() const;
+        std::int64_t cols() const;
+
+        // apply a Hann window to the image (only affects the displayed image and mask size estimate)
+        void setHann(bool hann);
+
+        // the window used by setHann, the mask size estimate and findGVectors (Hann by default)
+        void setWindow(WindowType type, double parameter = 0.0);
+
+        // estimate of the mask size from the FFT, as used to start the GUI (sigma = size / 6)
+        int estimateMaskSize();
+
+        // finds two g-vectors from the strongest non-parallel Bragg spots, ignoring anything within minRadius of the
+        // centre of the FFT (the mask radius, 3 * sigma, is a good choice). Throws if two can't be found
+        void findGVectors(double minRadius, GVector &g1, GVector &g2);
+
+        // set both g-vectors (FFT pixels) and the Gaussian mask sigma (FFT pixels)
+        void setGVectors(const GVector &g1, const GVector &g2, double sigma);
+
+        // set 2 or more g-vectors, with more than 2 the distortion is a least squares fit to all of them (weighted by
+        // the strength of each Bragg spot). Should be more robust to noise, but the extra spots must be from the same
+        // lattice
+        void setGVectors(const std::vector<GVector> &gs, double sigma);
+
+        int gVectorCount() const;
+
+        // refine a g-vector (index from 0) to flatten the phase in the given area, returns the new g-vector. Weighting uses the
+        // Bragg amplitude so parts of the area with weak fringes count for less
+        GVector refineGVector(int index, const Region &area, int repeats = 1, bool weighted = false);
+
+        // refine until the g-vector moves less than the tolerance (FFT pixels), for when no one is around to check it
+        RefineReport refineGVectorUntilConverged(int index, const Region &area, double tolerance = 1e-3,
+                                                 int maxIterations = 20, bool weighted = false);
+
+        GVector getGVector(int index) const;
+
+        // only work out the results over part of the image (in image pixels, as for refining), this is much quicker
+        // for a small area of a big image. The Result images are then the size of the area. The g-vectors still come
+        // from the FFT of the whole image, but areas for refining them have to be inside this one
+        void setRegionOfInterest(const Region &area);
+
+        // go back to results for the whole image
+        void clearRegionOfInterest();
+
+        // replace the current image, this must be the same size as the reference
+        void setImage(const ImageView &image);
+
+        // strain of the current image, g-vectors must have been set
+        Result process(double angle = 0.0, Mode mode = Mode::Distortion);
+
+        // setImage and process in one go, for working through stacks
+        Result process(const ImageView &image, double angle = 0.0, Mode mode = Mode::Distortion);
+
+    private:
+        void checkGVector(int index) const;
+
+        void toMatrixArea(const Region &area, int &t, int &l, int &b, int &r) const;
+
+        struct Impl;
+
+        // throws if this engine has been moved from
+        Impl &impl() const;
+
+        std::unique_ptr<Impl> _Impl;
+    };
+
+    std::string modeName(Mode mode);
+}
+
+#endif // STRAINPP_H
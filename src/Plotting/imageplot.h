@@ -17,6 +17,7 @@
 #include "tiffio.h"
 
 #include "exceptions.h"
+#include "stats.h"
 #include <Eigen/Dense>
 
 #include <iostream>
@@ -37,16 +38,20 @@ public:
 
     QCPDataColorMap(QCPAxis *keyAxis, QCPAxis *valueAxis) : QCPColorMap(keyAxis, valueAxis) {}
 
-    std::vector<double> getDataArray()
+    // the type is what it will be written as, so the conversion happens here instead of needing another pass
+    template <typename T = double>
+    std::vector<T> getDataArray()
     {
         // key is x, value is y?
-        std::vector<double> output(data()->valueSize()*data()->keySize());
+        Eigen::Index rows = data()->valueSize();
+        Eigen::Index cols = data()->keySize();
+        std::vector<T> output(rows*cols);
 
         // the odd indexing is because we need to export the image 'upside down'
         #pragma omp parallel for
-        for (int i = 0; i < data()->valueSize(); ++i)
-            for (int j = 0; j < data()->keySize(); ++j)
-                output[ i*data()->keySize() + j ] = data()->cell(j, data()->valueSize()-1-i);
+        for (Eigen::Index i = 0; i < rows; ++i)
+            for (Eigen::Index j = 0; j < cols; ++j)
+                output[ i*cols + j ] = static_cast<T>(data()->cell(j, rows-1-i));
 
         return output;
     }
@@ -136,7 +141,10 @@ public:
 
     void SetImage(const std::vector<double>& image, const int sx, const int sy, bool doReplot = true)
     {
-        if (sx*sy != (int)image.size())
+        STRAINPP_TIME("plot.set_image");
+
+        // 64-bit so large images can't overflow the check or the indexing below
+        if ((Eigen::Index)sx*sy != (Eigen::Index)image.size())
             throw sizeError;
 
         clearImage();
@@ -156,12 +164,14 @@ public:
         ImageObject->data()->setSize(sx, sy);
         ImageObject->data()->setRange(QCPRange(-(double)sx/2, (double)sx/2), QCPRange(-(double)sy/2, (double)sy/2));
         #pragma omp parallel for
-        for (int xIndex=0; xIndex<sx; ++xIndex)
-          for (int yIndex=0; yIndex<sy; ++yIndex)
+        for (Eigen::Index xIndex=0; xIndex<sx; ++xIndex)
+          for (Eigen::Index yIndex=0; yIndex<sy; ++yIndex)
             ImageObject->data()->setCell(xIndex, yIndex, image[yIndex*sx+xIndex]);
 
         size_x = sx;
         size_y = sy;
+        extent_x = sx;
+        extent_y = sy;
 
         ImageObject->rescaleDataRange(true);
         rescaleAxes();
@@ -175,7 +185,9 @@ public:
 
     void SetImage(const std::vector<std::complex<double>>& image, const int sx, const int sy, ShowComplex show, bool doReplot = true)
     {
-        if (sx*sy != (int)image.size())
+        STRAINPP_TIME("plot.set_image");
+
+        if ((Eigen::Index)sx*sy != (Eigen::Index)image.size())
             throw sizeError;
 
         clearImage();
@@ -197,41 +209,43 @@ public:
         if (show == ShowComplex::Real)
         {
             #pragma omp parallel for
-            for (int xIndex=0; xIndex<sx; ++xIndex)
-              for (int yIndex=0; yIndex<sy; ++yIndex)
+            for (Eigen::Index xIndex=0; xIndex<sx; ++xIndex)
+              for (Eigen::Index yIndex=0; yIndex<sy; ++yIndex)
                   ImageObject->data()->setCell(xIndex, yIndex, std::real(image[yIndex*sx+xIndex]));
         }
         else if (show == ShowComplex::Complex)
         {
             #pragma omp parallel for
-            for (int xIndex=0; xIndex<sx; ++xIndex)
-              for (int yIndex=0; yIndex<sy; ++yIndex)
+            for (Eigen::Index xIndex=0; xIndex<sx; ++xIndex)
+              for (Eigen::Index yIndex=0; yIndex<sy; ++yIndex)
                   ImageObject->data()->setCell(xIndex, yIndex, std::imag(image[yIndex*sx+xIndex]));
         }
         else if (show == ShowComplex::Phase)
         {
             #pragma omp parallel for
-            for (int xIndex=0; xIndex<sx; ++xIndex)
-              for (int yIndex=0; yIndex<sy; ++yIndex)
+            for (Eigen::Index xIndex=0; xIndex<sx; ++xIndex)
+              for (Eigen::Index yIndex=0; yIndex<sy; ++yIndex)
                   ImageObject->data()->setCell(xIndex, yIndex, std::arg(image[yIndex*sx+xIndex]));
         }
         else if (show == ShowComplex::Amplitude)
         {
             #pragma omp parallel for
-            for (int xIndex=0; xIndex<sx; ++xIndex)
-              for (int yIndex=0; yIndex<sy; ++yIndex)
+            for (Eigen::Index xIndex=0; xIndex<sx; ++xIndex)
+              for (Eigen::Index yIndex=0; yIndex<sy; ++yIndex)
                   ImageObject->data()->setCell(xIndex, yIndex, std::abs(image[yIndex*sx+xIndex]));
         }
         else if (show == ShowComplex::PowerSpectrum)
         {
             #pragma omp parallel for
-            for (int xIndex=0; xIndex<sx; ++xIndex)
-              for (int yIndex=0; yIndex<sy; ++yIndex)
+            for (Eigen::Index xIndex=0; xIndex<sx; ++xIndex)
+              for (Eigen::Index yIndex=0; yIndex<sy; ++yIndex)
                   ImageObject->data()->setCell(xIndex, yIndex, std::log10(1+std::abs(image[yIndex*sx+xIndex])));
         }
 
         size_x = sx;
         size_y = sy;
+        extent_x = sx;
+        extent_y = sy;
 
         ImageObject->rescaleDataRange(true);
         rescaleAxes();
@@ -243,6 +257,25 @@ public:
         haveImage = true;
     }
 
+    // shows the current image over width x height (centred as usual) instead of its own size, e.g. so a preview made
+    // from a binned image uses the same coordinates as the full image
+    void SetImageExtent(double width, double height, bool doReplot = true)
+    {
+        if (!haveImage)
+            return;
+
+        ImageObject->data()->setRange(QCPRange(-width/2, width/2), QCPRange(-height/2, height/2));
+
+        AspectRatio = width/height;
+        extent_x = width;
+        extent_y = height;
+
+        rescaleAxes();
+        setImageRatio();
+        if (doReplot)
+            replot();
+    }
+
     void DrawCircle(double x, double y, QColor colour = Qt::red, QBrush fill = QBrush(Qt::red), double radius = 2, Qt::PenStyle line = Qt::SolidLine, double thickness = 2)
     {
         QCPItemEllipse* circle(new QCPItemEllipse(this));
@@ -299,6 +332,9 @@ private:
 
     int size_x, size_y;
 
+    // the area the image is shown over, this is only different to its size after SetImageExtent
+    double extent_x, extent_y;
+
     int lastWidth, lastHeight;
 
     void resizeEvent(QResizeEvent* event)
@@ -452,9 +488,12 @@ private slots:
         QCPRange yr = yAxis->range();
 
         // the Axes are all screwed but this seems to work
-        // needed to export the right area
-        xAxis->setRange(QCPRange(-size_x/2, size_x/2));
-        yAxis->setRange(QCPRange(-size_y/2-1, size_y/2+1));
+        // needed to export the right area (scaled if the image is shown over a different area, it is still exported
+        // with one pixel per data point)
+        double scale_x = extent_x / size_x;
+        double scale_y = extent_y / size_y;
+        xAxis->setRange(QCPRange(scale_x*(-size_x/2), scale_x*(size_x/2)));
+        yAxis->setRange(QCPRange(scale_y*(-size_y/2-1), scale_y*(size_y/2+1)));
         saveRastered(filepath, size_x, size_y, 1.0, format.c_str());
 
         xAxis->setRange(xr);
@@ -491,7 +530,7 @@ private slots:
        TIFFSetField(out, TIFFTAG_IMAGEWIDTH, size_x);
        TIFFSetField(out, TIFFTAG_IMAGELENGTH, size_y);
        TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, 1);
-       TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, sizeof(float)*8);
+       TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, static_cast<uint16>(sizeof(float)*8));
        TIFFSetField(out, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
        TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, size_y);
 //       TIFFSetField(out, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT);
@@ -500,11 +539,7 @@ private slots:
        TIFFSetField(out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
 
        // virtually nothing supports 64-bit tiff so we will convert it here.
-       std::vector<float> buffer(size_x*size_y);
-       std::vector<double> data_temp = ImageObject->getDataArray();
-
-       for (int i = 0; i < size_x*size_y; ++i)
-           buffer[i] = (float)data_temp[i];
+       std::vector<float> buffer = ImageObject->getDataArray<float>();
 
        tsize_t image_s;
        if( (image_s = TIFFWriteEncodedStrip(out, 0, &buffer[0], sizeof(float)*size_x*size_y)) == -1)
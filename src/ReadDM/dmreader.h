@@ -12,6 +12,7 @@
 
 
 #include "tagreader.h"
+#include "stats.h"
 
 namespace DMRead
 {
@@ -76,7 +77,7 @@ namespace DMRead
             return std::string( charString.begin(), charString.end() );
         }
 
-        std::vector<double> getImage(int offset = 0, int length = -1)
+        std::vector<double> getImage(int64_t offset = 0, int64_t length = -1)
         {
             return ReadArray<double>("root.ImageList.1.ImageData.Data", offset, length);
         }
@@ -212,7 +213,7 @@ namespace DMRead
         }
 
         template <typename T>
-        std::vector<T> ReadArray(std::string TagName, int offset = 0, int length = -1)
+        std::vector<T> ReadArray(std::string TagName, int64_t offset = 0, int64_t length = -1)
         {
 
             // do this because RGB gives the same datatype as int32...
@@ -238,39 +239,40 @@ namespace DMRead
             if (offset + length > data_size)
                 throw std::runtime_error("Array selection out of bounds.");
 
-            std::vector<T> output(data_size);
+            // offset and length are in elements, the data is read from the file from the start of the selection
+            std::vector<T> output(length);
 
             switch(data_type)
             {
                 case int8:
-                    _ReadArray<T, int8_t>(output, data_type, data_position+offset, length);
+                    _ReadArray<T, int8_t>(output, data_type, data_position + offset * sizeof(int8_t), length);
                     break;
                 case int16:
-                    _ReadArray<T, int16_t>(output, data_type, data_position+offset, length);
+                    _ReadArray<T, int16_t>(output, data_type, data_position + offset * sizeof(int16_t), length);
                     break;
                 case int32:
-                    _ReadArray<T, int32_t>(output, data_type, data_position+offset, length);
+                    _ReadArray<T, int32_t>(output, data_type, data_position + offset * sizeof(int32_t), length);
                     break;
                 case uint8:
-                    _ReadArray<T, uint8_t>(output, data_type, data_position+offset, length);
+                    _ReadArray<T, uint8_t>(output, data_type, data_position + offset * sizeof(uint8_t), length);
                     break;
                 case uint16:
-                    _ReadArray<T, uint16_t>(output, data_type, data_position+offset, length);
+                    _ReadArray<T, uint16_t>(output, data_type, data_position + offset * sizeof(uint16_t), length);
                     break;
                 case uint32:
-                    _ReadArray<T, uint32_t>(output, data_type, data_position+offset, length);
+                    _ReadArray<T, uint32_t>(output, data_type, data_position + offset * sizeof(uint32_t), length);
                     break;
                 case float32:
-                    _ReadArray<T, float>(output, data_type, data_position+offset, length);
+                    _ReadArray<T, float>(output, data_type, data_position + offset * sizeof(float), length);
                     break;
                 case float64:
-                    _ReadArray<T, double>(output, data_type, data_position+offset, length);
+                    _ReadArray<T, double>(output, data_type, data_position + offset * sizeof(double), length);
                     break;
                 case int64:
-                    _ReadArray<T, int64_t>(output, data_type, data_position+offset, length);
+                    _ReadArray<T, int64_t>(output, data_type, data_position + offset * sizeof(int64_t), length);
                     break;
                 case uint64:
-                    _ReadArray<T, uint64_t>(output, data_type, data_position+offset, length);
+                    _ReadArray<T, uint64_t>(output, data_type, data_position + offset * sizeof(uint64_t), length);
                     break;
                 default:
                     throw std::runtime_error("Cannot open datatype");
@@ -279,8 +281,11 @@ namespace DMRead
         }
 
         template <typename T, typename X>
-        void _ReadArray(std::vector<T> &data, int type, int position, int size)
+        void _ReadArray(std::vector<T> &data, int type, int64_t position, int64_t size)
         {
+            STRAINPP_TIME("dm.read");
+            STRAINPP_COUNT("dm.bytes_read", size * sizeof(X));
+
             Reader.GoTo(position);
 //            for (int i = 0; i < size; ++i)
 //            {
@@ -289,7 +294,7 @@ namespace DMRead
             std::vector<X> buffer(size);
             Reader.ReadArray(buffer, size*sizeof(X));
             #pragma omp parallel for
-            for (int i = 0; i < size; ++i)
+            for (int64_t i = 0; i < size; ++i)
                 data[i] = (T)buffer[i];
         }
 
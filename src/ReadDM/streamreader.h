@@ -8,9 +8,19 @@
 #include <memory>
 #include <cstring>
 #include <cstdio>
+#include <cstdint>
 
 namespace DMRead
 {
+    // fseek/ftell use long, which is still 32 bit on windows (so no files over 2 GB)
+#ifdef _WIN32
+    inline int SeekFile(FILE* file, int64_t offset, int origin) {return _fseeki64(file, offset, origin);}
+    inline int64_t TellFile(FILE* file) {return _ftelli64(file);}
+#else
+    inline int SeekFile(FILE* file, int64_t offset, int origin) {return fseeko(file, static_cast<off_t>(offset), origin);}
+    inline int64_t TellFile(FILE* file) {return static_cast<int64_t>(ftello(file));}
+#endif
+
     class StreamReader
     {
     public:
@@ -69,9 +79,9 @@ namespace DMRead
             return dest.u;
         }
 
-        void Skip(int n)
+        void Skip(int64_t n)
         {
-            fseek(filePtr, n, SEEK_CUR);
+            SeekFile(filePtr, n, SEEK_CUR);
         }
 
         template<typename T>
@@ -81,7 +91,7 @@ namespace DMRead
         }
 
         template <typename T>
-        void ReadArray(std::vector<T> &v, int byteLength)
+        void ReadArray(std::vector<T> &v, size_t byteLength)
         {
             fread(&v[0], sizeof(T), byteLength/sizeof(T), filePtr);
         }
@@ -101,9 +111,9 @@ namespace DMRead
         }
 
         template<typename T>
-        int ReadNumericPos()
+        int64_t ReadNumericPos()
         {
-            int pos = ftell(filePtr);
+            int64_t pos = TellFile(filePtr);
             Skip<T>();
             return pos;
         }
@@ -118,21 +128,21 @@ namespace DMRead
             return text;
         }
 
-        int ReadStringPos(int length)
+        int64_t ReadStringPos(int64_t length)
         {
-            int pos = ftell(filePtr);
+            int64_t pos = TellFile(filePtr);
             Skip(length);
             return pos;
         }
 
-        int ReadPos()
+        int64_t ReadPos()
         {
-            return ftell(filePtr);
+            return TellFile(filePtr);
         }
 
-        void GoTo(int pos)
+        void GoTo(int64_t pos)
         {
-            fseek(filePtr, pos, SEEK_SET);
+            SeekFile(filePtr, pos, SEEK_SET);
         }
     };
 }
@@ -348,7 +348,7 @@ namespace DMRead
                             break;
                     }
 
-                    Reader.Skip(bytesPer*arrayLength);
+                    Reader.Skip(static_cast<int64_t>(bytesPer) * arrayLength);
                     //for (uint32_t i=0; i<arrayLength; i++)
                     //    GetData(arrayType, temp1, temp2);
                 }
@@ -1,115 +1,270 @@
 #include "gpa.h"
+#include <mutex>
 #include <iostream>
+#include <stdexcept>
+#include <exception>
 
-GPA::GPA(Eigen::MatrixXcd img)
-{    
+#include <omp.h>
+
+namespace {
+    // max-active-levels is the same for the whole program, so it is only raised while something is splitting its
+    // threads and put back when the last one has finished (several engines can be used from different threads)
+    class NestedLevels
+    {
+    public:
+        NestedLevels()
+        {
+            std::lock_guard<std::mutex> lock(mutex());
+            if (users()++ == 0)
+            {
+                saved() = omp_get_max_active_levels();
+                omp_set_max_active_levels(std::max(saved(), 2));
+            }
+        }
+
+        ~NestedLevels()
+        {
+            std::lock_guard<std::mutex> lock(mutex());
+            if (--users() == 0)
+                omp_set_max_active_levels(saved());
+        }
+
+        NestedLevels(const NestedLevels&) = delete;
+        NestedLevels &operator=(const NestedLevels&) = delete;
+
+    private:
+        static std::mutex &mutex() {static std::mutex m; return m;}
+        static int &users() {static int n = 0; return n;}
+        static int &saved() {static int levels = 1; return levels;}
+    };
+
+    std::shared_ptr<Eigen::MatrixXd> logPowerSpectrum(const Eigen::MatrixXcd &fft)
+    {
+        STRAINPP_TIME("gpa.power_spectrum");
+
+        auto ps = std::make_shared<Eigen::MatrixXd>(fft.rows(), fft.cols());
+
+        #pragma omp parallel for
+        for (Eigen::Index j = 0; j < ps->rows(); ++j)
+            for (Eigen::Index i = 0; i < ps->cols(); ++i)
+                (*ps)(j, i) = std::log10(1+std::abs( fft(j, i) ));
+
+        return ps;
+    }
+}
+
+GPA::GPA(const Eigen::MatrixXcd &img)
+{
+    initialise(static_cast<int>(img.rows()), static_cast<int>(img.cols()));
+
+    // do the FFT now
+    loadImage(img.data(), img.cols());
+}
+
+GPA::GPA(int rows, int cols, const GPA &planSource)
+{
+    if (rows != planSource._Image->rows() || cols != planSource._Image->cols())
+        throw std::invalid_argument("Can only share plans between images of the same size");
+
+    initialise(rows, cols, &planSource);
+}
+
+void GPA::initialise(int rows, int cols, const GPA *planSource)
+{
     // initialise vectors
     _Phases.resize(2);
-    _Image = std::make_shared<Eigen::MatrixXcd>(img);
-    _FFT = std::make_shared<Eigen::MatrixXcd>(Eigen::MatrixXcd(_Image->rows(), _Image->cols()));
+    _Image = std::make_shared<Eigen::MatrixXcd>(rows, cols);
+    _FFT = std::make_shared<Eigen::MatrixXcd>(rows, cols);
+    _Shifted = Eigen::MatrixXcd(rows, cols);
+    STRAINPP_COUNT("memory.bytes_allocated", 3 * static_cast<std::size_t>(rows) * cols * sizeof(std::complex<double>));
 
     _Do_Hann = false;
 
-    // I think I had an error when using NULL before as technically they are the same and FFTW tries to optimise
-    // for in-place FFTs..., These are just temporary to avoid that
-    // can't just make pointer as it gets compiled out in release builds?
-    fftw_complex temp_1 [1] = {};
-    fftw_complex temp_2 [1] = {};
+    if (planSource)
+    {
+        _FFTplan = planSource->_FFTplan;
+        _IFFTplan = planSource->_IFFTplan;
+        _FFTdiffplan = planSource->_FFTdiffplan;
+        _IFFTdiffplan = planSource->_IFFTdiffplan;
+        _IFFTrowplan = planSource->_IFFTrowplan;
+        _IFFTcolplan = planSource->_IFFTcolplan;
+        return;
+    }
 
-    _FFTplan = std::make_shared<fftw_plan>(fftw_plan_dft_2d(static_cast<int>(_Image->rows()),
-                                                                static_cast<int>(_Image->cols()), temp_1, temp_2, FFTW_FORWARD, FFTW_ESTIMATE));
-    _IFFTplan = std::make_shared<fftw_plan>(fftw_plan_dft_2d(static_cast<int>(_Image->rows()),
-                                                                 static_cast<int>(_Image->cols()), temp_1, temp_2, FFTW_BACKWARD, FFTW_ESTIMATE));
+    _FFTplan = UtilsFFT::MakePlan(rows, cols, FFTW_FORWARD);
+    _IFFTplan = UtilsFFT::MakePlan(rows, cols, FFTW_BACKWARD);
 
-    // do the FFT now
-    UtilsFFT::doForwardFFT(_FFTplan, UtilsFFT::preFFTShift(*_Image), *_FFT);
+    // these are made here so that phases don't need to make plans (which are slow, and one at a time)
+    _FFTdiffplan = UtilsFFT::MakePlan(rows + 2, cols + 2, FFTW_FORWARD);
+    _IFFTdiffplan = UtilsFFT::MakePlan(rows + 2, cols + 2, FFTW_BACKWARD);
+
+    // these are cheap to make, so are always there for if a region is set
+    _IFFTrowplan = UtilsFFT::MakePlan(cols, FFTW_BACKWARD);
+    _IFFTcolplan = UtilsFFT::MakePlan(rows, FFTW_BACKWARD);
 }
 
 std::shared_ptr<Eigen::MatrixXcd> GPA::getImage()
 {
     if (_Do_Hann)
-        return UtilsMaths::HannWindow(_Image);
+        return getWindowedImage();
     else
         return _Image;
 }
 
+std::shared_ptr<Eigen::MatrixXcd> GPA::getWindowedImage()
+{
+    if (!_Windowed)
+    {
+        _Windowed = std::make_shared<Eigen::MatrixXcd>();
+        UtilsWindow::Apply(_Window, *_Image, *_Windowed);
+    }
+
+    return _Windowed;
+}
+
+std::shared_ptr<Eigen::MatrixXcd> GPA::getWindowedFFT()
+{
+    if (!_WindowedFFT)
+    {
+        STRAINPP_TIME("gpa.window");
+
+        // the FFT input workspace is free after the image is loaded, so use it again here. The window and shift are
+        // done as the image is copied in
+        UtilsWindow::Apply(_Window, *_Image, _Shifted, true);
+
+        _WindowedFFT = std::make_shared<Eigen::MatrixXcd>(_Shifted.rows(), _Shifted.cols());
+        UtilsFFT::doForwardFFT(_FFTplan, _Shifted, *_WindowedFFT);
+    }
+
+    return _WindowedFFT;
+}
+
+const Eigen::MatrixXd &GPA::getFFTPowerSpectrum()
+{
+    if (!_PowerSpectrum)
+        _PowerSpectrum = logPowerSpectrum(*_FFT);
+    else
+        STRAINPP_COUNT("gpa.cache_hits", 1);
+
+    return *_PowerSpectrum;
+}
+
 std::shared_ptr<Eigen::MatrixXcd> GPA::getFFT()
 {
     return _FFT;
 }
 
-std::shared_ptr<Eigen::MatrixXd> GPA::getExx()
+std::shared_ptr<const Eigen::MatrixXd> GPA::getExx()
 {
     return _Exx;
 }
 
-std::shared_ptr<Eigen::MatrixXd> GPA::getExy()
+std::shared_ptr<const Eigen::MatrixXd> GPA::getExy()
 {
     return _Exy;
 }
 
-std::shared_ptr<Eigen::MatrixXd> GPA::getEyx()
+std::shared_ptr<const Eigen::MatrixXd> GPA::getEyx()
 {
     return _Eyx;
 }
 
-std::shared_ptr<Eigen::MatrixXd> GPA::getEyy()
+std::shared_ptr<const Eigen::MatrixXd> GPA::getEyy()
 {
     return _Eyy;
 }
 
+const Eigen::MatrixXd &GPA::getPowerSpectrum()
+{
+    if (!_WindowedPowerSpectrum)
+        _WindowedPowerSpectrum = logPowerSpectrum(*getWindowedFFT());
+
+    return *_WindowedPowerSpectrum;
+}
+
+std::vector<UtilsPeaks::Peak> GPA::findBraggPeaks(double minRadius)
+{
+    return UtilsPeaks::FindPeaks(getPowerSpectrum(), minRadius);
+}
+
+void GPA::findGVectors(double minRadius, Coord2D<double> &g1, Coord2D<double> &g2)
+{
+    UtilsPeaks::Peak p1, p2;
+    if (!UtilsPeaks::SelectBasis(findBraggPeaks(minRadius), p1, p2))
+        throw std::runtime_error("Could not find two g-vectors in the FFT");
+
+    g1 = Coord2D<double>(p1.x, p1.y);
+    g2 = Coord2D<double>(p2.x, p2.y);
+}
+
 int GPA::getGVectors()
 {
     int xs = static_cast<int>(_FFT->cols());
     int ys = static_cast<int>(_FFT->rows());
 
-    //Eigen::MatrixXd _PS(ys, xs);
-
-    Eigen::MatrixXcd _PS(ys, xs);
-    Eigen::MatrixXcd hanned = *UtilsMaths::HannWindow(_Image);
-    UtilsFFT::doForwardFFT(_FFTplan, UtilsFFT::preFFTShift(hanned), _PS);
-            //= UtilsMaths::HannWindow(original_image);;
-
-    // get power spectrum as this will be used quite a bit
-    #pragma omp parallel for
-    for (int xIndex = 0; xIndex < xs; ++xIndex)
-      for (int yIndex = 0; yIndex < ys; ++yIndex)
-          _PS(yIndex, xIndex) =  std::log10(1+std::abs( _PS(yIndex, xIndex) ));
+    const Eigen::MatrixXd &_PS = getPowerSpectrum();
 
     // convert back to matrix coordinates
     int x0 = xs/2;
     int y0 = ys/2;
 
-    double max = std::real(_PS(y0, x0));
+    double max = _PS(y0, x0);
+
+    // Average of the 10 largest values in bands 2 pixels wide (r-1 < distance < r+1) for each radius. This is done in
+    // one sweep over the pixels, each pixel can only be in the bands either side of its distance (or just the one if it
+    // is a whole number) so it is added to those. Each thread keeps its own top 10 for every band, then they are merged
+    const int top = 10;
+    int nBands = std::max(0, std::min(xs, ys) / 4 - 2);
+    int outer = nBands + 1;
+
+    std::vector<double> best(nBands * top);
+    std::vector<int> counts(nBands, 0);
+
+    // keeps the largest 'top' values of a band, sorted largest first
+    auto insert = [top](double *band, int &count, double v)
+    {
+        if (count == top && v <= band[top-1])
+            return;
 
-    std::vector<double> averages;
-    std::vector<double> vals;
+        int k = count < top ? count++ : top-1;
+        for (; k > 0 && band[k-1] < v; --k)
+            band[k] = band[k-1];
+        band[k] = v;
+    };
 
-    // loop through radii and sum
-    // can't use openmp due to use of push_back ???
-    for (int r = 1; r < std::min(xs, ys) / 4 - 1; ++r)
+    #pragma omp parallel
     {
-        vals.clear();
+        std::vector<double> localBest(nBands * top);
+        std::vector<int> localCounts(nBands, 0);
 
-        //get values within band
-        for (int j = 0; j <= y0+r; ++j)
-            for (int i = 0; i <= x0+r; ++i)
+        #pragma omp for nowait
+        for (int j = y0 - outer; j <= y0 + outer; ++j)
+            for (int i = x0 - outer; i <= x0 + outer; ++i)
             {
-                double dist = UtilsMaths::Distance(x0, y0, i, j);
-                if (dist < r+1 && dist > r-1)
-                    vals.push_back(std::real(_PS(j, i)));
-            }
+                int d2 = (i - x0)*(i - x0) + (j - y0)*(j - y0);
+                double dist = std::sqrt(d2);
 
-        std::sort(vals.begin(), vals.end(), std::greater<>());
+                int lower = static_cast<int>(dist);
+                int upper = lower * lower == d2 ? lower : lower + 1;
 
-        double av = 0;
-        int sz = std::min((int)vals.size(), 10);
+                for (int r = std::max(lower, 1); r <= std::min(upper, nBands); ++r)
+                    insert(&localBest[(r-1) * top], localCounts[r-1], _PS(j, i));
+            }
+
+        #pragma omp critical
+        for (int b = 0; b < nBands; ++b)
+            for (int k = 0; k < localCounts[b]; ++k)
+                insert(&best[b * top], counts[b], localBest[b * top + k]);
+    }
 
-        for (int i = 0; i < sz; ++i)
-            av += vals[i];
-        av /= (sz * max);
+    std::vector<double> averages(nBands);
 
-        averages.push_back(av);
+    for (int b = 0; b < nBands; ++b)
+    {
+        double av = 0;
+        for (int k = 0; k < counts[b]; ++k)
+            av += best[b * top + k];
+        averages[b] = av / (counts[b] * max);
     }
 
     if(averages.empty())
@@ -129,7 +284,7 @@ int GPA::getGVectors()
 
     // can't use openmp due to break statement
     // need to decide what's that fastest way of doing this
-    for(int i = 0; i < averages.size(); ++i)
+    for(size_t i = 0; i < averages.size(); ++i)
     {
         if (averages[i] < 0.9 * max)
         {
@@ -140,7 +295,7 @@ int GPA::getGVectors()
     }
 
     #pragma omp parallel for
-    for(int i = 0; i < averages.size(); ++i)
+    for(size_t i = 0; i < averages.size(); ++i)
     {
         averages[i] *= (averages.size() - i);
     }
@@ -152,30 +307,96 @@ int GPA::getGVectors()
 }
 
 
+Eigen::MatrixXcd GPA::getPreviewImage(int maxSize)
+{
+    STRAINPP_TIME("gpa.preview");
+
+    Eigen::Index rows = _FFT->rows();
+    Eigen::Index cols = _FFT->cols();
+
+    Eigen::Index factor = (std::max(rows, cols) + maxSize - 1) / maxSize;
+    if (factor <= 1)
+        return *_Image;
+
+    // the zero frequency is at (rows/2, cols/2) and has to end up at the same place in the smaller FFT
+    Eigen::Index r = rows / factor;
+    Eigen::Index c = cols / factor;
+    Eigen::MatrixXcd crop = _FFT->block(rows/2 - r/2, cols/2 - c/2, r, c);
+
+    Eigen::MatrixXcd inverse;
+    UtilsFFT::doBackwardFFT(nullptr, crop, inverse);
+
+    // normalised by the full size so the intensities stay the same, the crop isn't quite symmetric (at the Nyquist
+    // frequency) so only the real part is kept
+    double nn = rows * cols;
+    Eigen::MatrixXcd preview(r, c);
+
+    #pragma omp parallel for
+    for (Eigen::Index j = 0; j < r; ++j)
+        for (Eigen::Index i = 0; i < c; ++i)
+            preview(j, i) = UtilsFFT::CentreShift(inverse(j, i).real(), i, j) / nn;
+
+    return preview;
+}
+
 void GPA::calculatePhase(int i, double gx, double gy, double sig)
 {
-    //if (i != 0 && i != 1)
-        //throw
+    calculatePhase(i, gx, gy, sig, sig);
+}
+
+void GPA::calculatePhase(int i, double gx, double gy, double sigX, double sigY)
+{
+    if (i < 0)
+        throw std::out_of_range("Phase index must not be negative");
+
+    if (static_cast<std::size_t>(i) >= _Phases.size())
+        _Phases.resize(i + 1);
 
-    _Phases[i] = std::make_shared<Phase>(Phase(_FFT, gx, gy, sig, _FFTplan, _IFFTplan));
+    // an existing phase is kept (with its results if nothing has changed)
+    if (_Phases[i])
+    {
+        _Phases[i]->setSigma(sigX, sigY);
+        _Phases[i]->setGVectorPixels(gx, gy);
+    }
+    else
+    {
+        _Phases[i] = std::make_shared<Phase>(_FFT, gx, gy, sigX, _FFTplan, _IFFTplan, _FFTdiffplan, _IFFTdiffplan);
+        _Phases[i]->setSigma(sigX, sigY);
+        _Phases[i]->setRegion(_Region, _IFFTrowplan, _IFFTcolplan);
+    }
 }
 
-std::shared_ptr<Phase> GPA::getPhase(int i)
+void GPA::setRegion(const ImageRegion &region)
 {
-    //if (i != 0 && i != 1)
-        //throw
+    if (!region.empty())
+    {
+        if (region.row0 < 0 || region.col0 < 0 || region.row0 + region.rows > _Image->rows() ||
+            region.col0 + region.cols > _Image->cols())
+            throw std::out_of_range("Region is outside the image");
 
-    return _Phases[i];
+        if (region.rows < 3 || region.cols < 3)
+            throw std::invalid_argument("Region too small.");
+    }
+
+    _Region = region;
+
+    // the phases only throw their results away if their region actually changes
+    for (auto &phase : _Phases)
+        if (phase)
+            phase->setRegion(_Region, _IFFTrowplan, _IFFTcolplan);
 }
 
-void GPA::calculateDistortion(double angle, std::string mode)
+std::shared_ptr<Phase> GPA::getPhase(int i)
 {
-    Eigen::MatrixXcd d1dx, d1dy, d2dx, d2dy;
+    if (i < 0 || static_cast<std::size_t>(i) >= _Phases.size())
+        throw std::out_of_range("Phase index is out of range");
 
-    // get differential (rotated to coodinate system)
-    _Phases[0]->getDifferential(d1dx, d1dy, angle);
-    _Phases[1]->getDifferential(d2dx, d2dy, angle);
+    return _Phases[i];
+}
 
+void GPA::distortionFromTwo(double angle, const Eigen::MatrixXcd &d1dx, const Eigen::MatrixXcd &d1dy,
+                            const Eigen::MatrixXcd &d2dx, const Eigen::MatrixXcd &d2dy)
+{
     //calculate A matrix (from G matrix)
     //here I do several steps in one go, but all I am doing is Inverse(Transpose(G)) = A
     Eigen::Matrix<double, 2, 2> A;
@@ -196,34 +417,239 @@ void GPA::calculateDistortion(double angle, std::string mode)
     #pragma omp single
         {
         #pragma omp task
-            _Exx = std::make_shared<Eigen::MatrixXd>((factor * (A(0, 0) * d1dx + A(0, 1) * d2dx)).real());
+            _Dxx = std::make_shared<Eigen::MatrixXd>((factor * (A(0, 0) * d1dx + A(0, 1) * d2dx)).real());
         #pragma omp task
-            _Exy = std::make_shared<Eigen::MatrixXd>((factor * (A(0, 0) * d1dy + A(0, 1) * d2dy)).real());
+            _Dxy = std::make_shared<Eigen::MatrixXd>((factor * (A(0, 0) * d1dy + A(0, 1) * d2dy)).real());
         #pragma omp task
-            _Eyx = std::make_shared<Eigen::MatrixXd>((factor * (A(1, 0) * d1dx + A(1, 1) * d2dx)).real());
+            _Dyx = std::make_shared<Eigen::MatrixXd>((factor * (A(1, 0) * d1dx + A(1, 1) * d2dx)).real());
         #pragma omp task
-            _Eyy = std::make_shared<Eigen::MatrixXd>((factor * (A(1, 0) * d1dy + A(1, 1) * d2dy)).real());
+            _Dyy = std::make_shared<Eigen::MatrixXd>((factor * (A(1, 0) * d1dy + A(1, 1) * d2dy)).real());
+        }
+    }
+}
+
+void GPA::distortionFromMany(double angle, const std::vector<Eigen::MatrixXcd> &ddx,
+                             const std::vector<Eigen::MatrixXcd> &ddy)
+{
+    int n = static_cast<int>(_Phases.size());
+
+    // With more g-vectors than unknowns, the displacement gradient at each pixel is the weighted least squares fit to
+    // all the phase gradients. The noise in a phase goes as 1/amplitude so the weights are the Bragg amplitude^2
+    std::vector<Eigen::MatrixXd> weights;
+    std::vector<Coord2D<double>> gs;
+
+    for (auto &phase : _Phases)
+    {
+        weights.push_back(phase->getBraggAmplitude().array().square());
+        gs.push_back(phase->getGVector());
+    }
+
+    auto rotation = UtilsMaths::MakeRotationMatrix(angle);
+    double factor = -1.0 / (2.0 * PI);
+
+    Eigen::Index rows = ddx[0].rows();
+    Eigen::Index cols = ddx[0].cols();
+
+    _Dxx = std::make_shared<Eigen::MatrixXd>(rows, cols);
+    _Dxy = std::make_shared<Eigen::MatrixXd>(rows, cols);
+    _Dyx = std::make_shared<Eigen::MatrixXd>(rows, cols);
+    _Dyy = std::make_shared<Eigen::MatrixXd>(rows, cols);
+
+    #pragma omp parallel for
+    for (Eigen::Index p = 0; p < rows * cols; ++p)
+    {
+        // normal equations, G^T W G and G^T W d for the x and y derivatives
+        double m00 = 0, m01 = 0, m11 = 0;
+        double bx0 = 0, bx1 = 0, by0 = 0, by1 = 0;
+
+        for (int k = 0; k < n; ++k)
+        {
+            double w = weights[k](p);
+            double gx = gs[k].x;
+            double gy = gs[k].y;
+            double dx = std::real(ddx[k](p));
+            double dy = std::real(ddy[k](p));
+
+            m00 += w * gx * gx;
+            m01 += w * gx * gy;
+            m11 += w * gy * gy;
+            bx0 += w * gx * dx;
+            bx1 += w * gy * dx;
+            by0 += w * gx * dy;
+            by1 += w * gy * dy;
         }
+
+        double det = m00 * m11 - m01 * m01;
+        if (det == 0)
+        {
+            (*_Dxx)(p) = (*_Dxy)(p) = (*_Dyx)(p) = (*_Dyy)(p) = 0;
+            continue;
+        }
+
+        // displacement gradients (d ux / dx etc.)
+        double uxx = ( m11 * bx0 - m01 * bx1) / det;
+        double uyx = (-m01 * bx0 + m00 * bx1) / det;
+        double uxy = ( m11 * by0 - m01 * by1) / det;
+        double uyy = (-m01 * by0 + m00 * by1) / det;
+
+        // rotate the basis (the same as rotating A for two g-vectors)
+        (*_Dxx)(p) = factor * (rotation(0, 0) * uxx + rotation(0, 1) * uyx);
+        (*_Dyx)(p) = factor * (rotation(1, 0) * uxx + rotation(1, 1) * uyx);
+        (*_Dxy)(p) = factor * (rotation(0, 0) * uxy + rotation(0, 1) * uyy);
+        (*_Dyy)(p) = factor * (rotation(1, 0) * uxy + rotation(1, 1) * uyy);
     }
+}
+
+void GPA::computePhases()
+{
+    std::vector<std::shared_ptr<Phase>> phases;
+    for (auto &phase : _Phases)
+        if (phase)
+            phases.push_back(phase);
+
+    int n = static_cast<int>(phases.size());
+    if (n == 0)
+        return;
+
+    STRAINPP_TIME("gpa.phases");
+
+    int threads = omp_get_max_threads();
+
+    // nothing to split if this is already one of the threads of something else (e.g. a tile of TiledGPA)
+    if (n == 1 || threads == 1 || omp_in_parallel())
+    {
+        for (auto &phase : phases)
+            phase->getWrappedPhase();
+        return;
+    }
+
+    // Each phase only reads the FFT and has its own workspaces, so they can be done side by side. The loops (and FFTs)
+    // inside are parallel too, but on smaller images they don't keep all the threads busy so the threads are split
+    // between the phases instead of each phase having them all in turn
+    int outer = std::min(n, threads);
+    int inner = std::max(1, threads / outer);
+
+    // FFTW runs a plan with the threads it was made for (not OpenMP's setting), so the phases need an inverse plan for
+    // their share or they would each start all of them
+    if (_IFFTsplitThreads != inner)
+    {
+        _IFFTsplitplan = UtilsFFT::MakePlan(_Image->rows(), _Image->cols(), FFTW_BACKWARD, inner);
+        _IFFTsplitThreads = inner;
+    }
+
+    // without one (FFTW before 3.3.9) they just take turns
+    if (!_IFFTsplitplan)
+    {
+        for (auto &phase : phases)
+            phase->getWrappedPhase();
+        return;
+    }
+
+    NestedLevels levels;
+
+    // an exception can't leave the parallel loop, so the first one is kept and thrown after it
+    std::exception_ptr error;
+
+    #pragma omp parallel for num_threads(outer) schedule(dynamic, 1)
+    for (int k = 0; k < n; ++k)
+    {
+        omp_set_num_threads(inner);
+        phases[k]->setInversePlan(_IFFTsplitplan);
+
+        try
+        {
+            phases[k]->getWrappedPhase();
+        }
+        catch (...)
+        {
+            #pragma omp critical(gpaPhasesError)
+            {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+
+        phases[k]->setInversePlan(_IFFTplan);
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void GPA::calculateDistortion(double angle, std::string mode)
+{
+    std::vector<unsigned long> versions;
+    for (auto &phase : _Phases)
+    {
+        if (!phase)
+            throw std::runtime_error("All phases must be calculated before the distortion");
+        versions.push_back(phase->getVersion());
+    }
+
+    int n = static_cast<int>(_Phases.size());
+    if (n < 2)
+        throw std::runtime_error("At least two g-vectors are needed");
+
+    // only redo what has changed, the phases have new versions whenever they (or the image) change
+    bool distortionValid = _Dxx && versions == _DistortionVersions && angle == _DistortionAngle;
+
+    if (distortionValid && mode == _Mode)
+    {
+        STRAINPP_COUNT("gpa.cache_hits", 1);
+        return;
+    }
+
+    STRAINPP_TIME("gpa.distortion");
+
+    if (!distortionValid)
+    {
+        // the phases are worked out side by side if they aren't already (see computePhases), then the differentials
+        // (rotated to coodinate system) one after the other, so each gets all the threads for its loops and FFTs
+        computePhases();
+
+        std::vector<Eigen::MatrixXcd> ddx(n), ddy(n);
+        for (int k = 0; k < n; ++k)
+            _Phases[k]->getDifferential(ddx[k], ddy[k], angle);
+
+        if (n == 2)
+            distortionFromTwo(angle, ddx[0], ddy[0], ddx[1], ddy[1]);
+        else
+            distortionFromMany(angle, ddx, ddy);
+
+        _DistortionVersions = versions;
+        _DistortionAngle = angle;
+    }
+
+    _Mode = mode;
+
+    auto zeros = [this]() {return std::make_shared<Eigen::MatrixXd>(Eigen::MatrixXd::Constant(_Dxx->rows(), _Dxx->cols(), 0.0));};
 
     if (mode == "Strain")
     {
-        _Exy = std::make_shared<Eigen::MatrixXd>(0.5 * (*_Exy + *_Eyx));
-        _Eyx = std::make_shared<Eigen::MatrixXd>(*_Exy);
+        _Exx = _Dxx;
+        _Exy = std::make_shared<Eigen::MatrixXd>(0.5 * (*_Dxy + *_Dyx));
+        _Eyx = _Exy;
+        _Eyy = _Dyy;
     }
     else if (mode == "Rotation")
     {
-        auto temp = *_Exy;
-        _Exx = std::make_shared<Eigen::MatrixXd>( Eigen::MatrixXd::Constant(_Exx->rows(), _Exx->cols(), 0.0) );
-        _Exy = std::make_shared<Eigen::MatrixXd>(0.5 * (*_Exy - *_Eyx));
-        _Eyx = std::make_shared<Eigen::MatrixXd>(0.5 * (*_Eyx - temp));
-        _Eyy = std::make_shared<Eigen::MatrixXd>( Eigen::MatrixXd::Constant(_Eyy->rows(), _Eyy->cols(), 0.0) );
+        _Exx = zeros();
+        _Exy = std::make_shared<Eigen::MatrixXd>(0.5 * (*_Dxy - *_Dyx));
+        _Eyx = std::make_shared<Eigen::MatrixXd>(0.5 * (*_Dyx - *_Dxy));
+        _Eyy = zeros();
     }
     else if (mode == "Dilitation")
     {
-        _Exx = std::make_shared<Eigen::MatrixXd>(*_Exx + *_Eyy);
-        _Exy = std::make_shared<Eigen::MatrixXd>( Eigen::MatrixXd::Constant(_Exx->rows(), _Exx->cols(), 0.0) );
-        _Eyx = std::make_shared<Eigen::MatrixXd>( Eigen::MatrixXd::Constant(_Exx->rows(), _Exx->cols(), 0.0) );
-        _Eyy = std::make_shared<Eigen::MatrixXd>( Eigen::MatrixXd::Constant(_Eyy->rows(), _Eyy->cols(), 0.0) );
+        _Exx = std::make_shared<Eigen::MatrixXd>(*_Dxx + *_Dyy);
+        _Exy = zeros();
+        _Eyx = zeros();
+        _Eyy = zeros();
+    }
+    else
+    {
+        _Exx = _Dxx;
+        _Exy = _Dxy;
+        _Eyx = _Dyx;
+        _Eyy = _Dyy;
     }
 }
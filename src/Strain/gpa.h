@@ -15,7 +15,10 @@ const double PI = 3.14159265358979323846;
 #endif
 
 #include <memory>
+#include <vector>
+#include <string>
 #include <complex>
+#include <cstddef>
 #include <algorithm>
 #include <functional>
 
@@ -23,6 +26,8 @@ const double PI = 3.14159265358979323846;
 
 #include <Eigen/Dense>
 #include "utils.h"
+#include "peaks.h"
+#include "windows.h"
 #include "phase.h"
 #include "coord.h"
 
@@ -31,56 +36,219 @@ class GPA
 private:
     bool _Do_Hann;
 
+    UtilsWindow::Window _Window;
+
     std::shared_ptr<Eigen::MatrixXcd> _Image, _FFT;
     
-    std::shared_ptr<Eigen::MatrixXd> _Exx, _Exy, _Eyx, _Eyy;
+    // the results, after the mode has been applied. These can be the same matrices as the distortion below (so they
+    // aren't copied), which is why they are only ever handed out as const
+    std::shared_ptr<const Eigen::MatrixXd> _Exx, _Exy, _Eyx, _Eyy;
+
+    // the distortion before the mode is applied, and what it was worked out from. Changing the mode only redoes the
+    // last step, changing the angle (or anything in the phases) redoes it all
+    std::shared_ptr<Eigen::MatrixXd> _Dxx, _Dxy, _Dyx, _Dyy;
+    std::vector<unsigned long> _DistortionVersions;
+    double _DistortionAngle = 0.0;
+    std::string _Mode;
 
     std::vector<std::shared_ptr<Phase>> _Phases;
 
-    std::shared_ptr<fftw_plan> _FFTplan, _IFFTplan;
+    // the diff plans are shared by all the phases (for their differentials)
+    std::shared_ptr<fftw_plan> _FFTplan, _IFFTplan, _FFTdiffplan, _IFFTdiffplan;
+
+    // 1D inverse plans along a row and a column, for the phases to use when there is a region
+    std::shared_ptr<fftw_plan> _IFFTrowplan, _IFFTcolplan;
+
+    // the inverse plan for a share of the threads, for when the phases are done side by side (made when first needed)
+    std::shared_ptr<fftw_plan> _IFFTsplitplan;
+    int _IFFTsplitThreads = 0;
+
+    // the phases (and so the distortion) are only worked out over this if it isn't empty
+    ImageRegion _Region;
+
+    // input to the forward FFT, kept so it isn't reallocated for every image of a stack
+    Eigen::MatrixXcd _Shifted;
+
+    // worked out the first time they are asked for, then kept until the image changes (null when not worked out)
+    std::shared_ptr<Eigen::MatrixXcd> _Windowed, _WindowedFFT;
+    std::shared_ptr<Eigen::MatrixXd> _PowerSpectrum, _WindowedPowerSpectrum;
+
+    void clearWindowCaches()
+    {
+        _Windowed.reset();
+        _WindowedFFT.reset();
+        _WindowedPowerSpectrum.reset();
+    }
+
+    void clearCaches()
+    {
+        _Windowed.reset();
+        _WindowedFFT.reset();
+        _PowerSpectrum.reset();
+        _WindowedPowerSpectrum.reset();
+    }
+
+    // plans are copied from planSource if it is given (it must be the same size)
+    void initialise(int rows, int cols, const GPA *planSource = nullptr);
+
+    // one pass over the input that fills the image and the shifted FFT input, then does the FFT
+    template <typename T>
+    void loadImage(const T *data, std::ptrdiff_t rowStride)
+    {
+        Eigen::Index rows = _Image->rows();
+        Eigen::Index cols = _Image->cols();
+
+        {
+            STRAINPP_TIME("gpa.pre_shift");
+
+            #pragma omp parallel for
+            for (Eigen::Index j = 0; j < rows; ++j)
+            {
+                const T *row = data + j * rowStride;
+                for (Eigen::Index i = 0; i < cols; ++i)
+                {
+                    auto v = static_cast<std::complex<double>>(row[i]);
+                    (*_Image)(j, i) = v;
+                    _Shifted(j, i) = UtilsFFT::CentreShift(v, i, j);
+                }
+            }
+        }
+
+        UtilsFFT::doForwardFFT(_FFTplan, _Shifted, *_FFT);
+
+        clearCaches();
+    }
+
+    void distortionFromTwo(double angle, const Eigen::MatrixXcd &d1dx, const Eigen::MatrixXcd &d1dy,
+                           const Eigen::MatrixXcd &d2dx, const Eigen::MatrixXcd &d2dy);
+
+    void distortionFromMany(double angle, const std::vector<Eigen::MatrixXcd> &ddx, const std::vector<Eigen::MatrixXcd> &ddy);
+
+    void updatePhases()
+    {
+        // phases might not have been set yet
+        for (auto &phase : _Phases)
+            if (phase)
+                phase->updateFFT(_FFT);
+
+        computePhases();
+    }
 
 public:
 
-    explicit GPA(Eigen::MatrixXcd img);
+    explicit GPA(const Eigen::MatrixXcd &img);
 
-    void updateImage(Eigen::MatrixXcd img)
+    // a blank image that uses the same FFTW plans as 'planSource' (which must be the same size), so doesn't go near the
+    // planner. For having lots of engines of the same size, e.g. one for each thread
+    GPA(int rows, int cols, const GPA &planSource);
+
+    // Takes the image straight from the caller's memory (e.g. a frame grabber's buffer) without copying it first.
+    // 'data' points to the first row of the image as the engine sees it (the bottom of the image as it is plotted) and
+    // rowStride is the distance between rows in elements, so a negative stride reads an image stored top row first.
+    template <typename T>
+    GPA(const T *data, int rows, int cols, std::ptrdiff_t rowStride)
     {
-        if (img.rows() != _Image->rows() || img.cols() != _Image->cols())
-            return;
+        initialise(rows, cols);
+        loadImage(data, rowStride);
+    }
 
-        _Image = std::make_shared<Eigen::MatrixXcd>(img);
-        UtilsFFT::doForwardFFT(_FFTplan, UtilsFFT::preFFTShift(*_Image), *_FFT);
+    void updateImage(const Eigen::MatrixXcd &img)
+    {
+        updateImage(img.data(), static_cast<int>(img.rows()), static_cast<int>(img.cols()), img.cols());
+    }
 
-        _Phases[0]->updateFFT(_FFT);
-        _Phases[1]->updateFFT(_FFT);
+    template <typename T>
+    void updateImage(const T *data, int rows, int cols, std::ptrdiff_t rowStride)
+    {
+        if (rows != _Image->rows() || cols != _Image->cols())
+            return;
 
-        _Phases[0]->getWrappedPhase();
-        _Phases[1]->getWrappedPhase();
+        loadImage(data, rowStride);
+        updatePhases();
     }
 
     std::shared_ptr<Eigen::MatrixXcd> getImage();
 
     std::shared_ptr<Eigen::MatrixXcd> getFFT();
 
-    std::shared_ptr<Eigen::MatrixXd> getExx();
+    // windowed image and its FFT (these are cached)
+    std::shared_ptr<Eigen::MatrixXcd> getWindowedImage();
 
-    std::shared_ptr<Eigen::MatrixXd> getExy();
+    std::shared_ptr<Eigen::MatrixXcd> getWindowedFFT();
 
-    std::shared_ptr<Eigen::MatrixXd> getEyx();
+    // log power spectrum of the FFT, as it is displayed (cached)
+    const Eigen::MatrixXd &getFFTPowerSpectrum();
 
-    std::shared_ptr<Eigen::MatrixXd> getEyy();
+    // A smaller version of the image for quick previews, made from the middle of the FFT (so it is binned without any
+    // aliasing). The FFT pixels are the same size as this one's, so g-vectors and sigma are the same for an engine made
+    // from it, as long as they fit in its smaller FFT. Each side is at most maxSize, the image is given back as it is if
+    // it already fits. This makes an FFTW plan (under the planner lock, see UtilsFFT::MakePlan)
+    Eigen::MatrixXcd getPreviewImage(int maxSize);
 
+    std::shared_ptr<const Eigen::MatrixXd> getExx();
+
+    std::shared_ptr<const Eigen::MatrixXd> getExy();
+
+    std::shared_ptr<const Eigen::MatrixXd> getEyx();
+
+    std::shared_ptr<const Eigen::MatrixXd> getEyy();
+
+    // whether getImage returns the windowed image
     void setDoHann(bool set)
     {
         _Do_Hann = set;
     }
 
+    // the window used for the windowed image, FFT and power spectrum (Hann by default)
+    void setWindow(const UtilsWindow::Window &window)
+    {
+        if (window == _Window)
+            return;
+
+        _Window = window;
+        clearWindowCaches();
+    }
+
+    const UtilsWindow::Window &getWindow() const {return _Window;}
+
     int getGVectors();
 
+    // log power spectrum of the windowed image, this is what the automatic g-vector finding is done on (cached)
+    const Eigen::MatrixXd &getPowerSpectrum();
+
+    // candidate g-vectors (FFT pixels from the centre), strongest first. Anything within minRadius of the centre is
+    // ignored, half of the mask size estimate from getGVectors is a good value
+    std::vector<UtilsPeaks::Peak> findBraggPeaks(double minRadius);
+
+    // the two strongest candidates that aren't parallel, throws if there aren't two
+    void findGVectors(double minRadius, Coord2D<double> &g1, Coord2D<double> &g2);
+
+    // Only work out the phases and distortion over part of the image (the region of interest), this saves nearly all
+    // of the time for a small region of a big image. The results (and anything from the phases apart from the masks)
+    // are then the size of the region, the image and FFT are still the whole image. Set an empty region to go back
+    void setRegion(const ImageRegion &region);
+
+    const ImageRegion &getRegion() const {return _Region;}
+
+    // there are two phases to start with, setting a higher index adds more (for using more than 2 g-vectors)
     void calculatePhase(int i, double gx, double gy, double sig);
 
+    // the same with a different sigma down the FFT (y) to across it (x), so the mask can match one on a different
+    // shaped FFT (as the tiles of TiledGPA do)
+    void calculatePhase(int i, double gx, double gy, double sigX, double sigY);
+
     std::shared_ptr<Phase> getPhase(int i);
 
+    int getPhaseCount() {return static_cast<int>(_Phases.size());}
+
+    // calculates the (wrapped) phase of every phase that has been set, all at the same time
+    void computePhases();
+
+    // back to the two (empty) phases, for when a smaller set of g-vectors is used
+    void clearPhases() {_Phases.assign(2, nullptr);}
+
+    // needs at least the first two phases, any more are combined by a least squares fit at each pixel. Does nothing if
+    // nothing has changed since the last call
     void calculateDistortion(double angle, std::string mode);
 
     Coord2D<int> getSize()
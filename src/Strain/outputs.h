@@ -0,0 +1,101 @@
+#ifndef OUTPUTS_H
+#define OUTPUTS_H
+
+#ifndef EIGEN_DEFAULT_TO_ROW_MAJOR
+#define EIGEN_DEFAULT_TO_ROW_MAJOR
+#endif
+
+#ifndef EIGEN_INITIALIZE_MATRICES_BY_ZERO
+#define EIGEN_INITIALIZE_MATRICES_BY_ZERO
+#endif
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <Eigen/Dense>
+#include "gpa.h"
+
+// Gathers the results of a finished GPA into named images, using the same names as the exports from the GUI
+namespace StrainOutputs {
+
+    typedef std::vector<std::pair<std::string, Eigen::MatrixXd>> NamedImages;
+
+    // same order as the combo boxes for the 'other' plots (without the '/' as these are used for file names)
+    const std::vector<std::string> PhaseOutputNames = {"Mask", "Masked FFT", "Bragg image", "Raw phase", "Phase",
+                                                       "Normalised phase", "dPhasedx", "dPhasedy"};
+
+    inline Eigen::MatrixXd PowerSpectrum(const Eigen::MatrixXcd &input)
+    {
+        Eigen::MatrixXd ps(input.rows(), input.cols());
+
+        #pragma omp parallel for
+        for (Eigen::Index i = 0; i < ps.size(); ++i)
+            ps(i) = std::log10(1+std::abs(input(i)));
+
+        return ps;
+    }
+
+    // calculateDistortion must have been called with the same mode. Setting 'all' also includes the image, FFT and the
+    // intermediate images from each phase (these are what is exported by 'Export all'), the phase differentials are
+    // rotated by 'angle' the same as the distortion
+    inline NamedImages Collect(GPA &engine, const std::string &mode, bool all, double angle = 0.0)
+    {
+        NamedImages out;
+
+        if (all)
+        {
+            out.emplace_back("image", engine.getImage()->real());
+            out.emplace_back("FFT", engine.getFFTPowerSpectrum());
+        }
+
+        if (mode == "Distortion")
+        {
+            out.emplace_back("exx", *engine.getExx());
+            out.emplace_back("exy", *engine.getExy());
+            out.emplace_back("eyx", *engine.getEyx());
+            out.emplace_back("eyy", *engine.getEyy());
+        }
+        else if(mode == "Strain")
+        {
+            out.emplace_back("epsxx", *engine.getExx());
+            out.emplace_back("epsxy", *engine.getExy());
+            // this is symmetric, 'Export all' has always skipped it
+            if (!all)
+                out.emplace_back("epsyx", *engine.getEyx());
+            out.emplace_back("epsyy", *engine.getEyy());
+        }
+        else if(mode == "Rotation")
+        {
+            out.emplace_back("wxy", *engine.getExy());
+            out.emplace_back("wyx", *engine.getEyx());
+        }
+        else if(mode == "Dilitation")
+        {
+            out.emplace_back("Dilitation", *engine.getExx());
+        }
+
+        if (!all)
+            return out;
+
+        for (int p = 0; p < engine.getPhaseCount(); ++p)
+        {
+            auto phase = engine.getPhase(p);
+
+            Eigen::MatrixXcd dx, dy;
+            phase->getDifferential(dx, dy, angle);
+
+            std::vector<Eigen::MatrixXd> others = {phase->getGaussianMask(), PowerSpectrum(phase->getMaskedFFT()),
+                                                   phase->getBraggImage(), phase->getRawPhase(), phase->getPhase(),
+                                                   phase->getWrappedPhase(), dx.real(), dy.real()};
+
+            std::string name = "Phase " + std::to_string(p+1) + " ";
+            for (size_t k = 0; k < others.size(); ++k)
+                out.emplace_back(name + PhaseOutputNames[k], others[k]);
+        }
+
+        return out;
+    }
+}
+
+#endif // OUTPUTS_H
@@ -1,89 +1,317 @@
 #include "phase.h"
 
 #include "iostream"
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+    // versions are unique over all phases, so a new phase can't be mistaken for an old one
+    unsigned long nextVersion()
+    {
+        static std::atomic<unsigned long> counter(0);
+        return ++counter;
+    }
+}
 
-Phase::Phase(std::shared_ptr<Eigen::MatrixXcd> inputFFT, double gx, double gy, double sigma, std::shared_ptr<fftw_plan> forwardPlan, std::shared_ptr<fftw_plan> inversePlan)
+Phase::Phase(std::shared_ptr<Eigen::MatrixXcd> inputFFT, double gx, double gy, double sigma, std::shared_ptr<fftw_plan> forwardPlan, std::shared_ptr<fftw_plan> inversePlan,
+             std::shared_ptr<fftw_plan> forwardDiffPlan, std::shared_ptr<fftw_plan> inverseDiffPlan)
 {
-    _angle = 0;
     _FFT = std::move(inputFFT);
     _gxPx = gx;
     _gyPx = gy;
     _gx = _gxPx / _FFT->cols();
     _gy = _gyPx / _FFT->rows();
     _sigma = sigma;
+    _sigmaY = sigma;
+    _originX = 0;
+    _originY = 0;
 
     _FFTplan = std::move(forwardPlan);
     _IFFTplan = std::move(inversePlan);
+    _FFTdiffplan = std::move(forwardDiffPlan);
+    _IFFTdiffplan = std::move(inverseDiffPlan);
+
+    invalidate();
+}
+
+void Phase::invalidate()
+{
+    _InverseValid = false;
+    _WrappedValid = false;
+    _DiffValid = false;
+    _Version = nextVersion();
+}
+
+void Phase::setGVectorPixels(double gx, double gy)
+{
+    if (gx == _gxPx && gy == _gyPx)
+        return;
 
-    fftw_complex temp_1 [1] = {};
-    fftw_complex temp_2 [1] = {};
+    _gxPx = gx;
+    _gyPx = gy;
+    _gx = _gxPx / _FFT->cols();
+    _gy = _gyPx / _FFT->rows();
+    invalidate();
+}
 
-    _FFTdiffplan = std::make_shared<fftw_plan>(fftw_plan_dft_2d(static_cast<int>(_FFT->rows() + 2),
-                                                                static_cast<int>(_FFT->cols() + 2), temp_1, temp_2, FFTW_FORWARD, FFTW_ESTIMATE));
-    _IFFTdiffplan = std::make_shared<fftw_plan>(fftw_plan_dft_2d(static_cast<int>(_FFT->rows() + 2),
-                                                                 static_cast<int>(_FFT->cols() + 2), temp_1, temp_2, FFTW_BACKWARD, FFTW_ESTIMATE));
+void Phase::setOrigin(double x, double y)
+{
+    if (x == _originX && y == _originY)
+        return;
+
+    _originX = x;
+    _originY = y;
 
+    // the inverse FFT doesn't depend on this
+    _WrappedValid = false;
+    _DiffValid = false;
+    _Version = nextVersion();
 }
 
-Eigen::MatrixXd Phase::getGaussianMask()
+void Phase::setSigma(double sigma)
+{
+    setSigma(sigma, sigma);
+}
+
+void Phase::setSigma(double sigmaX, double sigmaY)
+{
+    if (sigmaX == _sigma && sigmaY == _sigmaY)
+        return;
+
+    _sigma = sigmaX;
+    _sigmaY = sigmaY;
+    invalidate();
+}
+
+void Phase::setRegion(const ImageRegion &region, std::shared_ptr<fftw_plan> rowPlan,
+                      std::shared_ptr<fftw_plan> columnPlan)
+{
+    _IFFTrowplan = std::move(rowPlan);
+    _IFFTcolplan = std::move(columnPlan);
+
+    if (region == _Region)
+        return;
+
+    _Region = region;
+    invalidate();
+}
+
+ImageRegion Phase::outputArea() const
+{
+    if (!_Region.empty())
+        return _Region;
+
+    ImageRegion all;
+    all.rows = _FFT->rows();
+    all.cols = _FFT->cols();
+    return all;
+}
+
+ImageRegion Phase::inverseArea() const
+{
+    if (_Region.empty())
+        return outputArea();
+
+    ImageRegion area;
+    area.row0 = std::max<Eigen::Index>(_Region.row0 - 1, 0);
+    area.col0 = std::max<Eigen::Index>(_Region.col0 - 1, 0);
+    area.rows = std::min<Eigen::Index>(_Region.row0 + _Region.rows + 1, _FFT->rows()) - area.row0;
+    area.cols = std::min<Eigen::Index>(_Region.col0 + _Region.cols + 1, _FFT->cols()) - area.col0;
+    return area;
+}
+
+void Phase::getMaskProfiles(Eigen::VectorXd &x, Eigen::VectorXd &y)
 {
     // this just shifts everything back to 0,0 at lower right corner
     double xf = _gxPx + _FFT->cols()/2;
     double yf = _gyPx + _FFT->rows()/2;
 
+    x.resize(_FFT->cols());
+    y.resize(_FFT->rows());
+
+    // the Gaussian is separable, so only need rows + cols exps instead of one for every pixel
+    for (Eigen::Index i = 0; i < x.size(); ++i)
+    {
+        double xc = (double)i - xf;
+        x(i) = std::exp( -0.5 * xc*xc / (_sigma*_sigma) );
+    }
+
+    for (Eigen::Index j = 0; j < y.size(); ++j)
+    {
+        double yc = (double)j - yf;
+        y(j) = std::exp( -0.5 * yc*yc / (_sigmaY*_sigmaY) );
+    }
+}
+
+Eigen::MatrixXd Phase::getGaussianMask()
+{
+    Eigen::VectorXd x, y;
+    getMaskProfiles(x, y);
+
     Eigen::MatrixXd mask(_FFT->rows(), _FFT->cols());
 
     #pragma omp parallel for
-    for (int j = 0; j < _FFT->rows(); ++j)
+    for (Eigen::Index j = 0; j < mask.rows(); ++j)
+        for (Eigen::Index i = 0; i < mask.cols(); ++i)
+            mask(j, i) = y(j) * x(i);
+
+    return mask;
+}
+
+void Phase::maskFFT(Eigen::MatrixXcd &out)
+{
+    STRAINPP_TIME("phase.mask");
+
+    Eigen::VectorXd x, y;
+    getMaskProfiles(x, y);
+
+    out.resize(_FFT->rows(), _FFT->cols());
+
+    #pragma omp parallel for
+    for (Eigen::Index j = 0; j < out.rows(); ++j)
+        for (Eigen::Index i = 0; i < out.cols(); ++i)
+            out(j, i) = (*_FFT)(j, i) * (y(j) * x(i));
+}
+
+Eigen::MatrixXcd Phase::getMaskedFFT()
+{
+    Eigen::MatrixXcd maskedFFT;
+    maskFFT(maskedFFT);
+    return maskedFFT;
+}
+
+const Eigen::MatrixXcd &Phase::getInverse()
+{
+    if (!_InverseValid)
     {
-        double yc = (double)j - yf;
-        for (int i = 0; i < _FFT->cols(); ++i)
+        STRAINPP_TIME("phase.inverse");
+
+        if (_Region.empty())
         {
-            double xc = (double)i - xf;
-            mask(j*mask.cols() + i) = std::exp( -0.5 * (xc*xc + yc*yc) / (_sigma*_sigma) );
+            maskFFT(_MaskedWork);
+            UtilsFFT::doBackwardFFT(_IFFTplan, _MaskedWork, _InverseWork);
         }
+        else
+            regionInverse(_InverseWork);
+
+        _InverseValid = true;
     }
+    else
+        STRAINPP_COUNT("phase.cache_hits", 1);
 
-    return mask;
+    return _InverseWork;
 }
 
-Eigen::MatrixXcd Phase::getMaskedFFT()
+void Phase::regionInverse(Eigen::MatrixXcd &out)
 {
-    Eigen::MatrixXd mask = getGaussianMask();
-    //return (*_FFT).cwiseProduct(mask);
+    if (!_IFFTrowplan || !_IFFTcolplan)
+        throw std::logic_error("Region set without its plans");
 
-    Eigen::MatrixXcd maskedFFT(mask.rows(), mask.cols());
+    Eigen::Index rows = _FFT->rows();
+    Eigen::Index cols = _FFT->cols();
+    ImageRegion area = inverseArea();
 
-    maskedFFT = _FFT->cwiseProduct(mask);
+    Eigen::VectorXd x, y;
+    getMaskProfiles(x, y);
 
-    return maskedFFT;
+    // The mask is Gaussian so is below 1e-12 of its peak past 7.5 sigma, only that part of the FFT is transformed. The
+    // inverse is separable, so the rows are done first (only keeping the columns in the area) then the columns of that
+    double reachX = 7.5 * _sigma;
+    double reachY = 7.5 * _sigmaY;
+    double xf = _gxPx + cols/2;
+    double yf = _gyPx + rows/2;
+
+    Eigen::Index u0 = std::max<Eigen::Index>(static_cast<Eigen::Index>(std::floor(xf - reachX)), 0);
+    Eigen::Index u1 = std::min<Eigen::Index>(static_cast<Eigen::Index>(std::ceil(xf + reachX)), cols - 1);
+    Eigen::Index v0 = std::max<Eigen::Index>(static_cast<Eigen::Index>(std::floor(yf - reachY)), 0);
+    Eigen::Index v1 = std::min<Eigen::Index>(static_cast<Eigen::Index>(std::ceil(yf + reachY)), rows - 1);
+
+    out.resize(area.rows, area.cols);
+    out.setZero();
+
+    // the mask is entirely off the FFT
+    if (u1 < u0 || v1 < v0)
+        return;
+
+    Eigen::Index nv = v1 - v0 + 1;
+    Eigen::MatrixXcd partial(nv, area.cols);
+
+    #pragma omp parallel for
+    for (Eigen::Index v = 0; v < nv; ++v)
+    {
+        Eigen::VectorXcd line = Eigen::VectorXcd::Zero(cols);
+        Eigen::VectorXcd result(cols);
+
+        for (Eigen::Index u = u0; u <= u1; ++u)
+            line(u) = (*_FFT)(v0 + v, u) * (y(v0 + v) * x(u));
+
+        fftw_execute_dft(*_IFFTrowplan, reinterpret_cast<fftw_complex*>(line.data()),
+                         reinterpret_cast<fftw_complex*>(result.data()));
+
+        partial.row(v) = result.segment(area.col0, area.cols).transpose();
+    }
+
+    #pragma omp parallel for
+    for (Eigen::Index i = 0; i < area.cols; ++i)
+    {
+        Eigen::VectorXcd line = Eigen::VectorXcd::Zero(rows);
+        Eigen::VectorXcd result(rows);
+
+        line.segment(v0, nv) = partial.col(i);
+
+        fftw_execute_dft(*_IFFTcolplan, reinterpret_cast<fftw_complex*>(line.data()),
+                         reinterpret_cast<fftw_complex*>(result.data()));
+
+        out.col(i) = result.segment(area.row0, area.rows);
+    }
 }
 
 Eigen::MatrixXd Phase::getBraggImage()
 {
-    Eigen::MatrixXcd IFFT(_FFT->rows(), _FFT->cols());
+    // IFFT of masked FFT then return abs or real part
+    const Eigen::MatrixXcd &IFFT = getInverse();
+    ImageRegion out = outputArea(), area = inverseArea();
+    Eigen::Index dr = out.row0 - area.row0, dc = out.col0 - area.col0;
+
+    Eigen::MatrixXd bragg(out.rows, out.cols);
+    double nn = _FFT->rows() * _FFT->cols();
 
-    // do IFFT of masked FFT then return abs or real part
-    UtilsFFT::doBackwardFFT(_IFFTplan, getMaskedFFT(), IFFT);
+    // shift is done as the real part is taken
+    #pragma omp parallel for
+    for (Eigen::Index j = 0; j < bragg.rows(); ++j)
+        for (Eigen::Index i = 0; i < bragg.cols(); ++i)
+            bragg(j, i) = 2 * UtilsFFT::CentreShift(IFFT(j + dr, i + dc).real(), i + out.col0, j + out.row0) / nn;
+
+    return bragg;
+}
 
-    IFFT = UtilsFFT::preFFTShift(IFFT);
+Eigen::MatrixXd Phase::getBraggAmplitude()
+{
+    const Eigen::MatrixXcd &IFFT = getInverse();
+    ImageRegion out = outputArea(), area = inverseArea();
 
-    return 2 * IFFT.real() / (IFFT.rows() * IFFT.cols());
+    // no shift needed as the sign doesn't matter here
+    return 2 * IFFT.block(out.row0 - area.row0, out.col0 - area.col0, out.rows, out.cols).cwiseAbs()
+           / (_FFT->rows() * _FFT->cols());
 }
 
 Eigen::MatrixXd Phase::getRawPhase()
 {
     // only extracting phase so FFT normalising not needed
-    Eigen::MatrixXd phase(_FFT->rows(), _FFT->cols());
-    Eigen::MatrixXcd IFFT(_FFT->rows(), _FFT->cols());
-
-    UtilsFFT::doBackwardFFT(_IFFTplan, getMaskedFFT(), IFFT);
+    const Eigen::MatrixXcd &IFFT = getInverse();
+    ImageRegion out = outputArea(), area = inverseArea();
+    Eigen::Index dr = out.row0 - area.row0, dc = out.col0 - area.col0;
 
-    IFFT = UtilsFFT::preFFTShift(IFFT);
+    Eigen::MatrixXd phase(out.rows, out.cols);
 
     // don't think eigen has a bette version of this
-    for(int i = 0; i < phase.size(); ++i)
-        phase(i) = std::arg(IFFT(i));
+    // (shift is done as the phase is taken)
+    #pragma omp parallel for
+    for(Eigen::Index j = 0; j < phase.rows(); ++j)
+        for(Eigen::Index i = 0; i < phase.cols(); ++i)
+            phase(j, i) = std::arg(UtilsFFT::CentreShift(IFFT(j + dr, i + dc), i + out.col0, j + out.row0));
 
     return phase;
 }
@@ -91,37 +319,94 @@ Eigen::MatrixXd Phase::getRawPhase()
 Eigen::MatrixXd Phase::getPhase()
 {
     Eigen::MatrixXd phase = getRawPhase();
+    ImageRegion out = outputArea();
 
     // can this be made faster in eigen?
     #pragma omp parallel for
-    for(int j = 0; j < phase.rows(); ++j)
-        for(int i =0; i < phase.cols(); ++i)
-            phase(j, i) = phase(j, i) - 2*PI * (i*_gx + j*_gy);
+    for(Eigen::Index j = 0; j < phase.rows(); ++j)
+        for(Eigen::Index i =0; i < phase.cols(); ++i)
+            phase(j, i) = phase(j, i) - 2*PI * ((i + out.col0 + _originX)*_gx + (j + out.row0 + _originY)*_gy);
 
     return phase;
 }
 
-Eigen::MatrixXd Phase::getWrappedPhase()
+void Phase::updateWrappedPhase()
 {
-    Eigen::MatrixXd phase = getPhase();
+    if (_WrappedValid)
+    {
+        STRAINPP_COUNT("phase.cache_hits", 1);
+        return;
+    }
 
+    const Eigen::MatrixXcd &IFFT = getInverse();
+    ImageRegion out = outputArea(), area = inverseArea();
+    Eigen::Index dr = out.row0 - area.row0, dc = out.col0 - area.col0;
+
+    STRAINPP_TIME("phase.arg");
+
+    _NormPhase.resize(out.rows, out.cols);
+
+    // this is getRawPhase, getPhase and the wrapping in one go
     #pragma omp parallel for
-    for(int i = 0; i < phase.size(); ++i)
-        phase(i) -= std::round(phase(i) / (2*PI)) * 2*PI;
+    for(Eigen::Index j = 0; j < _NormPhase.rows(); ++j)
+        for(Eigen::Index i = 0; i < _NormPhase.cols(); ++i)
+        {
+            Eigen::Index x = i + out.col0, y = j + out.row0;
+            double phase = std::arg(UtilsFFT::CentreShift(IFFT(j + dr, i + dc), x, y)) - 2*PI * ((x + _originX)*_gx + (y + _originY)*_gy);
+            _NormPhase(j, i) = phase - std::round(phase / (2*PI)) * 2*PI;
+        }
 
-    _NormPhase = phase;
+    _WrappedValid = true;
+}
+
+const Eigen::MatrixXd &Phase::getWrappedPhase()
+{
+    updateWrappedPhase();
 
     return _NormPhase;
 }
 
 void Phase::getDifferential(Eigen::MatrixXcd &dx, Eigen::MatrixXcd &dy, double angle)
 {
-    _angle = angle;
-    getDifferential(dx, dy);
+    updateDifferential();
+
+    auto rotMat = UtilsMaths::MakeRotationMatrix(angle);
+
+    dx = rotMat(0,0) * _DiffX + rotMat(0,1) * _DiffY;
+    dy = rotMat(1,0) * _DiffX + rotMat(1,1) * _DiffY;
 }
 
 void Phase::getDifferential(Eigen::MatrixXcd &dx, Eigen::MatrixXcd &dy)
 {
+    updateDifferential();
+
+    dx = _DiffX;
+    dy = _DiffY;
+}
+
+void Phase::updateDifferential()
+{
+    if (_DiffValid)
+    {
+        STRAINPP_COUNT("phase.cache_hits", 1);
+        return;
+    }
+
+    if (!_Region.empty())
+    {
+        regionDifferential();
+        _DiffValid = true;
+        return;
+    }
+
+    updateWrappedPhase();
+
+    STRAINPP_TIME("phase.differential");
+    STRAINPP_COUNT("memory.bytes_allocated", (5 * (_FFT->rows() + 2) * (_FFT->cols() + 2) + 2 * _FFT->size())
+                                             * sizeof(std::complex<double>));
+
+    Eigen::MatrixXcd &dx = _DiffX;
+    Eigen::MatrixXcd &dy = _DiffY;
     dx = Eigen::MatrixXcd(_FFT->rows(), _FFT->cols());
     dy = Eigen::MatrixXcd(_FFT->rows(), _FFT->cols());
     // contains the convolution kernel, then the resultant differential
@@ -151,8 +436,8 @@ void Phase::getDifferential(Eigen::MatrixXcd &dx, Eigen::MatrixXcd &dy)
     // create padded exponential phase matrix
     std::complex<double> im(0, 1);
     #pragma omp parallel for
-    for (int i = 0; i < _NormPhase.rows(); ++i)
-        for (int j = 0; j < _NormPhase.cols(); ++j)
+    for (Eigen::Index i = 0; i < _NormPhase.rows(); ++i)
+        for (Eigen::Index j = 0; j < _NormPhase.cols(); ++j)
             expPhase(i, j) = std::exp(im * _NormPhase(i, j));
 
     #pragma omp parallel
@@ -170,7 +455,7 @@ void Phase::getDifferential(Eigen::MatrixXcd &dx, Eigen::MatrixXcd &dy)
 
     // do convolution
     #pragma omp parallel for
-    for (int i = 0; i < phaseTemp.size(); ++i)
+    for (Eigen::Index i = 0; i < phaseTemp.size(); ++i)
     {
         xTemp(i) = xTemp(i) * phaseTemp(i);
         yTemp(i) = yTemp(i) * phaseTemp(i);
@@ -191,8 +476,8 @@ void Phase::getDifferential(Eigen::MatrixXcd &dx, Eigen::MatrixXcd &dy)
     double nn = (_FFT->rows()+2)*(_FFT->cols()+2);
 
     #pragma omp parallel for
-    for (int i = 1; i < expPhase.rows()-1; ++i)
-        for (int j = 1; j < expPhase.cols()-1; ++j)
+    for (Eigen::Index i = 1; i < expPhase.rows()-1; ++i)
+        for (Eigen::Index j = 1; j < expPhase.cols()-1; ++j)
         {
             std::complex<double> ph = std::conj(expPhase(i, j));
             // TODO: test this is correct
@@ -202,13 +487,53 @@ void Phase::getDifferential(Eigen::MatrixXcd &dx, Eigen::MatrixXcd &dy)
             dy(i-1, j-1) = std::imag(ph * dy_kernel(i, j) / (nn*6));
         }
 
-    auto rotMat = UtilsMaths::MakeRotationMatrix(_angle);
+    _DiffValid = true;
+}
+
+void Phase::regionDifferential()
+{
+    const Eigen::MatrixXcd &IFFT = getInverse();
+    ImageRegion out = outputArea(), area = inverseArea();
+
+    STRAINPP_TIME("phase.differential");
+
+    // exponential of the wrapped phase over the region and a pixel around it, outside the image is 0 like the padding
+    // of the convolution. e(j, i) is pixel (out.row0 + j - 1, out.col0 + i - 1)
+    Eigen::MatrixXcd e = Eigen::MatrixXcd::Zero(out.rows + 2, out.cols + 2);
+    std::complex<double> im(0, 1);
+
+    #pragma omp parallel for
+    for (Eigen::Index j = 0; j < e.rows(); ++j)
+        for (Eigen::Index i = 0; i < e.cols(); ++i)
+        {
+            Eigen::Index x = out.col0 + i - 1, y = out.row0 + j - 1;
+            if (y < area.row0 || y >= area.row0 + area.rows || x < area.col0 || x >= area.col0 + area.cols)
+                continue;
+
+            double phase = std::arg(UtilsFFT::CentreShift(IFFT(y - area.row0, x - area.col0), x, y)) - 2*PI * ((x + _originX)*_gx + (y + _originY)*_gy);
+            e(j, i) = std::exp(im * (phase - std::round(phase / (2*PI)) * 2*PI));
+        }
+
+    _DiffX = Eigen::MatrixXcd(out.rows, out.cols);
+    _DiffY = Eigen::MatrixXcd(out.rows, out.cols);
 
-    Eigen::MatrixXcd temp;
-    temp = rotMat(0,0) * dx + rotMat(0,1) * dy;
-    dy = rotMat(1,0) * dx + rotMat(1,1) * dy;
-    dx = temp;
+    // the kernels in updateDifferential written out, including which pixel the conjugate is taken from
+    #pragma omp parallel for
+    for (Eigen::Index j = 0; j < out.rows; ++j)
+        for (Eigen::Index i = 0; i < out.cols; ++i)
+        {
+            std::complex<double> ph = std::conj(e(j + 2, i + 2));
+
+            std::complex<double> sx = 0, sy = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                sx += e(j + k, i + 2) - e(j + k, i);
+                sy += e(j + 2, i + k) - e(j, i + k);
+            }
 
+            _DiffX(j, i) = std::imag(ph * sx / 6.0);
+            _DiffY(j, i) = std::imag(ph * sy / 6.0);
+        }
 }
 
 Coord2D<double> Phase::getGVector()
@@ -221,38 +546,63 @@ Coord2D<double> Phase::getGVectorPixels()
     return {_gxPx, _gyPx};
 }
 
-void Phase::refinePhase(int t, int l, int b, int r)
+void Phase::refinePhase(int t, int l, int b, int r, bool weighted)
 {
     // Here we use linear regression to find the gradient of the selected area,
     // We then readjust the G-vectors to flatten this gradient.
-    Eigen::MatrixXd area(t-b, r-l);
+    updateWrappedPhase();
 
-    #pragma omp parallel for
-    for (int j = 0; j < t-b; ++j)
-        for (int i = 0; i < r-l; ++i)
-            area(j, i) = _NormPhase(j+b, i+l);
+    STRAINPP_TIME("phase.refine");
 
-    Eigen::MatrixXd X(area.size(), 3);
+    // the wrapped phase only covers the region
+    ImageRegion out = outputArea();
+    if (b < out.row0 || l < out.col0 || t > out.row0 + out.rows || r > out.col0 + out.cols)
+        throw std::out_of_range("Refinement area is outside the region");
 
-    #pragma omp parallel for
-    for (int i = 0; i < area.cols(); ++i)
-        for (int j = 0; j < area.rows(); ++j)
-        {
-            X(i + j*area.cols(), 0) = 1;
-            X(i + j*area.cols(), 1) = i;
-            X(i + j*area.cols(), 2) = j;
-        }
+    int row0 = static_cast<int>(b - out.row0);
+    int col0 = static_cast<int>(l - out.col0);
 
-    area.resize(area.size(), 1);
-
-    // need rows == rows...
-    Eigen::Vector3d C = X.jacobiSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(area);
+    Eigen::Vector3d C;
+    if (weighted)
+    {
+        // the noise in the phase goes as 1/amplitude, so weight by amplitude^2. This is taken straight from the
+        // inverse (the normalisation doesn't change the fit) so there isn't a whole Bragg amplitude image made each time
+        ImageRegion area = inverseArea();
+        C = UtilsMaths::FitPlane(_NormPhase, row0, col0, t-b, r-l, &getInverse(), b - area.row0, l - area.col0);
+    }
+    else
+        C = UtilsMaths::FitPlane(_NormPhase, row0, col0, t-b, r-l);
 
     double dGxPx = C[1] / (2*PI) * _FFT->cols();
     double dGyPx = C[2] / (2*PI) * _FFT->rows();
 
-    _gxPx += dGxPx;
-    _gyPx += dGyPx;
-    _gx = _gxPx/_FFT->cols();
-    _gy = _gyPx/_FFT->rows();
+    setGVectorPixels(_gxPx + dGxPx, _gyPx + dGyPx);
+}
+
+RefineReport Phase::refineUntilConverged(int t, int l, int b, int r, double tolerance, int maxIterations, bool weighted)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    RefineReport report;
+
+    while (report.iterations < maxIterations)
+    {
+        double oldX = _gxPx;
+        double oldY = _gyPx;
+
+        refinePhase(t, l, b, r, weighted);
+        updateWrappedPhase();
+        ++report.iterations;
+
+        report.change = std::sqrt((_gxPx - oldX)*(_gxPx - oldX) + (_gyPx - oldY)*(_gyPx - oldY));
+        if (report.change < tolerance)
+        {
+            report.converged = true;
+            break;
+        }
+    }
+
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return report;
 }
@@ -23,50 +23,166 @@ const double PI = 3.14159265358979323846;
 #include "utils.h"
 #include "coord.h"
 
+// part of the image in matrix indices (row 0 is the bottom of the image as it is plotted)
+struct ImageRegion
+{
+    Eigen::Index row0 = 0, col0 = 0, rows = 0, cols = 0;
+
+    bool empty() const {return rows < 1 || cols < 1;}
+
+    bool operator==(const ImageRegion &other) const
+    {
+        return row0 == other.row0 && col0 == other.col0 && rows == other.rows && cols == other.cols;
+    }
+    bool operator!=(const ImageRegion &other) const {return !(*this == other);}
+};
+
+// what happened during refineUntilConverged
+struct RefineReport
+{
+    int iterations = 0;
+
+    // size of the last change to the g-vector (FFT pixels)
+    double change = 0;
+
+    double seconds = 0;
+
+    bool converged = false;
+};
+
 class Phase
 {
 private:
 
     double _gxPx, _gyPx, _gx, _gy, _sigma;
 
+    // sigma down the columns, only different to _sigma when the mask has to match one on a differently shaped FFT
+    double _sigmaY;
+
+    // position of the first pixel in a bigger image (e.g. for tiles), so the phase is relative to the same place
+    double _originX, _originY;
+
     std::shared_ptr<Eigen::MatrixXcd> _FFT;
 
     Eigen::MatrixXd _NormPhase;
 
+    // if this isn't empty, everything from the inverse FFT onwards is only worked out over this part of the image
+    ImageRegion _Region;
+
+    // kept between calls so repeated phase calculations (e.g. refining) don't reallocate
+    Eigen::MatrixXcd _MaskedWork, _InverseWork;
+
+    // unrotated differentials, the rotation is cheap so is done when they are asked for
+    Eigen::MatrixXcd _DiffX, _DiffY;
+
+    // Each stage is only worked out when something asks for it, then kept until something it depends on changes:
+    // FFT, g, sigma -> inverse FFT of the masked FFT -> wrapped phase -> differentials
+    bool _InverseValid, _WrappedValid, _DiffValid;
+
+    // changes every time the phase does, so anything made from it (i.e. the distortion) can tell it is out of date
+    unsigned long _Version;
+
+    void invalidate();
+
+    // 1D parts of the (separable) Gaussian mask
+    void getMaskProfiles(Eigen::VectorXd &x, Eigen::VectorXd &y);
+
+    void maskFFT(Eigen::MatrixXcd &out);
+
+    // the part of the image the results cover (the region, or all of it)
+    ImageRegion outputArea() const;
+
+    // the part of the image the inverse covers, the region needs a pixel either side of it for the differentials
+    ImageRegion inverseArea() const;
+
+    // inverse FFT of the masked FFT (not shifted), over inverseArea
+    const Eigen::MatrixXcd &getInverse();
+
+    // the inverse over inverseArea only, from 1D transforms of the part of the FFT the mask doesn't zero
+    void regionInverse(Eigen::MatrixXcd &out);
+
+    void updateWrappedPhase();
+
+    void updateDifferential();
+
+    // the same differentials as updateDifferential, but done directly over the region
+    void regionDifferential();
+
     std::shared_ptr<fftw_plan> _FFTplan, _IFFTplan, _FFTdiffplan, _IFFTdiffplan;
 
-    double _angle;
+    // 1D inverse plans the length of a row and of a column, only needed for a region
+    std::shared_ptr<fftw_plan> _IFFTrowplan, _IFFTcolplan;
 
 public:
 
-    Phase(std::shared_ptr<Eigen::MatrixXcd> inputFFT, double gx, double gy, double sigma, std::shared_ptr<fftw_plan> forwardPlan, std::shared_ptr<fftw_plan> inversePlan);
+    // the diff plans are for the differential convolution, which is padded by 1 pixel on each side
+    Phase(std::shared_ptr<Eigen::MatrixXcd> inputFFT, double gx, double gy, double sigma, std::shared_ptr<fftw_plan> forwardPlan, std::shared_ptr<fftw_plan> inversePlan,
+          std::shared_ptr<fftw_plan> forwardDiffPlan, std::shared_ptr<fftw_plan> inverseDiffPlan);
 
     void updateFFT(std::shared_ptr<Eigen::MatrixXcd> inputFFT)
     {
-        _FFT = inputFFT;
+        _FFT = std::move(inputFFT);
+        invalidate();
     }
 
+    // these only throw away the results if the value actually changes
+    void setGVectorPixels(double gx, double gy);
+
+    void setSigma(double sigma);
+
+    // separate sigmas across (x) and down (y) the FFT, in its pixels
+    void setSigma(double sigmaX, double sigmaY);
+
+    double getSigma() const {return _sigma;}
+
+    // where pixel (0, 0) is in a bigger image, the phase is then measured from the origin of that image
+    void setOrigin(double x, double y);
+
+    // a plan the same as the one it was made with, but e.g. for a different number of threads (the results are the same)
+    void setInversePlan(std::shared_ptr<fftw_plan> plan) {_IFFTplan = std::move(plan);}
+
+    unsigned long getVersion() const {return _Version;}
+
+    // Only work out the phase over part of the image (an empty region goes back to all of it). The FFT is still of the
+    // whole image so the results are the same as that part of the full results, but the inverse FFT, phase and
+    // differentials are only done over the region. The plans are 1D inverse FFTs the length of a row and a column
+    void setRegion(const ImageRegion &region, std::shared_ptr<fftw_plan> rowPlan, std::shared_ptr<fftw_plan> columnPlan);
+
+    const ImageRegion &getRegion() const {return _Region;}
+
     Eigen::MatrixXd getGaussianMask();
 
     Eigen::MatrixXcd getMaskedFFT();
 
     Eigen::MatrixXd getBraggImage();
 
+    Eigen::MatrixXd getBraggAmplitude();
+
     Eigen::MatrixXd getRawPhase();
 
     Eigen::MatrixXd getPhase();
 
-    Eigen::MatrixXd getWrappedPhase();
+    // the reference stays valid until the phase changes
+    const Eigen::MatrixXd &getWrappedPhase();
 
     Coord2D<double> getGVector();
 
     Coord2D<double> getGVectorPixels();
 
+    // differentials of the phase, rotated by angle (degrees)
     void getDifferential(Eigen::MatrixXcd &dx, Eigen::MatrixXcd &dy, double angle);
 
+    // unrotated differentials
     void getDifferential(Eigen::MatrixXcd &dx, Eigen::MatrixXcd &dy);
 
-    void refinePhase(int t, int l, int b, int r);
+    // weighted uses the Bragg amplitude so areas with weak fringes count for less. The area is in the indices of the
+    // whole image, and has to be inside the region if there is one
+    void refinePhase(int t, int l, int b, int r, bool weighted = false);
+
+    // keeps refining until the g-vector moves less than 'tolerance' (FFT pixels) or maxIterations is reached,
+    // the wrapped phase is up to date when this returns
+    RefineReport refineUntilConverged(int t, int l, int b, int r, double tolerance = 1e-3, int maxIterations = 20,
+                                      bool weighted = false);
 };
 
 #endif // PHASE_H
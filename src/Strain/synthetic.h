@@ -0,0 +1,321 @@
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#ifndef EIGEN_DEFAULT_TO_ROW_MAJOR
+#define EIGEN_DEFAULT_TO_ROW_MAJOR
+#endif
+
+#ifndef EIGEN_INITIALIZE_MATRICES_BY_ZERO
+#define EIGEN_INITIALIZE_MATRICES_BY_ZERO
+#endif
+
+#include <array>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+#include <Eigen/Dense>
+#include "coord.h"
+#include "utils.h"
+
+// Lattice images made up from displacement fields that are known exactly, so the GPA results can be checked against
+// the answer (and benchmarked at any size) without needing real data.
+//
+// The image is I(r) = offset + sum over g of cos(2 pi g.(r - u(r))), which is the perfect lattice moved by u. Then the
+// phase of each g is exactly -2 pi g.u and the GPA distortion is the gradient of u, which is worked out analytically.
+// Everything is in the engine's orientation (row 0 at the bottom, x along the columns) with r measured from the centre
+// pixel (cols/2, rows/2), the same as the g-vectors in FFT pixels
+namespace StrainSynthetic {
+
+    enum class FieldType { Uniform, Rotation, Misfit, DislocationDipole };
+
+    struct Field
+    {
+        FieldType type = FieldType::Uniform;
+
+        // Uniform: displacement gradient (the same as the GPA distortion, exy is d ux / dy)
+        double exx = 0.0, exy = 0.0, eyx = 0.0, eyy = 0.0;
+
+        // Rotation: anticlockwise, degrees
+        double angle = 0.0;
+
+        // Misfit: the part above 'position' (pixels from the centre in y) is stretched in y by 'misfit', e.g. a layer
+        // grown on a substrate that fits it in x. The change happens smoothly over about 'width' pixels
+        double misfit = 0.0, position = 0.0, width = 2.0;
+
+        // DislocationDipole: two edge dislocations of opposite sign 'separation' pixels apart in x (either side of the
+        // centre). The Burgers vector is in pixels, a zero one is the first lattice vector (so the cut between them is
+        // invisible). Isotropic elasticity with Poisson's ratio 'poisson'
+        double separation = 64.0, burgersX = 0.0, burgersY = 0.0, poisson = 0.3;
+    };
+
+    struct Settings
+    {
+        int rows = 512, cols = 512;
+
+        // number of slices in the stack, each has its own noise (and is moved by 'drift' pixels in x from the last)
+        int depth = 1;
+        double drift = 0.0;
+
+        // in cycles per pixel, so the lattice is the same at any size (the defaults are periods of 8 and 10 pixels)
+        std::vector<Coord2D<double>> gVectors = {Coord2D<double>(1.0 / 8.0, 0.0), Coord2D<double>(0.0, 1.0 / 10.0)};
+
+        // the displacements of all of these are added together
+        std::vector<Field> fields;
+
+        // standard deviation of Gaussian noise added to the image, each fringe has an amplitude of 1
+        double noise = 0.0;
+        std::uint64_t seed = 1;
+
+        // the reference distortion takes four more images' worth of memory, it can be left out (e.g. for benchmarks)
+        bool reference = true;
+    };
+
+    struct Sample
+    {
+        std::vector<Eigen::MatrixXd> images;
+
+        // the distortion the GPA should give (Distortion mode, no rotation of the axes), this is the same for every slice
+        // and empty if it wasn't asked for
+        Eigen::MatrixXd exx, exy, eyx, eyy;
+
+        // the g-vectors in FFT pixels (for GPA::calculatePhase)
+        std::vector<Coord2D<double>> gVectors;
+    };
+
+    // displacement and its gradient at one point
+    struct Displacement
+    {
+        double ux = 0.0, uy = 0.0;
+        double uxx = 0.0, uxy = 0.0, uyx = 0.0, uyy = 0.0;
+
+        Displacement &operator+=(const Displacement &other)
+        {
+            ux += other.ux;
+            uy += other.uy;
+            uxx += other.uxx;
+            uxy += other.uxy;
+            uyx += other.uyx;
+            uyy += other.uyy;
+            return *this;
+        }
+    };
+
+    // the first lattice vector (pixels) of the lattice with these g-vectors, i.e. a1.g1 = 1 and a1.g2 = 0
+    inline Coord2D<double> FirstLatticeVector(const std::vector<Coord2D<double>> &gs)
+    {
+        double det = gs[0].x * gs[1].y - gs[0].y * gs[1].x;
+        if (det == 0)
+            throw std::invalid_argument("The first two g-vectors can't be parallel");
+
+        return Coord2D<double>(gs[1].y / det, -gs[1].x / det);
+    }
+
+    // one edge dislocation at the origin with its Burgers vector along x (Hirth and Lothe), scaled by 'sign'
+    inline Displacement EdgeDislocation(double x, double y, double b, double poisson, double sign)
+    {
+        // the field is singular at the core, this keeps it finite (the results aren't meaningful there anyway)
+        double r2 = std::max(x * x + y * y, 1.0);
+        double r4 = r2 * r2;
+        double k = 1.0 / (2.0 * (1.0 - poisson));
+        double s = sign * b / (2 * PI);
+
+        Displacement d;
+        d.ux = s * (std::atan2(y, x) + k * x * y / r2);
+        d.uy = -s * ((1 - 2 * poisson) * k / 2 * std::log(r2) + k / 2 * (x * x - y * y) / r2);
+
+        d.uxx = s * (-y / r2 + k * y * (y * y - x * x) / r4);
+        d.uxy = s * (x / r2 + k * x * (x * x - y * y) / r4);
+        d.uyx = -s * ((1 - 2 * poisson) * k * x / r2 + 2 * k * x * y * y / r4);
+        d.uyy = -s * ((1 - 2 * poisson) * k * y / r2 - 2 * k * x * x * y / r4);
+        return d;
+    }
+
+    inline Displacement FieldAt(const Field &field, double x, double y, const Coord2D<double> &a1)
+    {
+        Displacement d;
+
+        switch (field.type)
+        {
+            case FieldType::Uniform:
+                d.uxx = field.exx;
+                d.uxy = field.exy;
+                d.uyx = field.eyx;
+                d.uyy = field.eyy;
+                d.ux = field.exx * x + field.exy * y;
+                d.uy = field.eyx * x + field.eyy * y;
+                break;
+            case FieldType::Rotation:
+            {
+                // the point now at r came from R^-1 r, so u = (I - R^-1) r
+                double c = std::cos(field.angle * PI / 180.0);
+                double s = std::sin(field.angle * PI / 180.0);
+                d.uxx = 1 - c;
+                d.uxy = -s;
+                d.uyx = s;
+                d.uyy = 1 - c;
+                d.ux = d.uxx * x + d.uxy * y;
+                d.uy = d.uyx * x + d.uyy * y;
+                break;
+            }
+            case FieldType::Misfit:
+            {
+                // eyy goes from 0 to misfit as a tanh step, uy is its integral (which is smooth as well)
+                double w = std::max(field.width, 1e-3);
+                double t = (y - field.position) / w;
+                d.uyy = field.misfit * 0.5 * (1 + std::tanh(t));
+                // log(cosh(t)) without overflowing for large t
+                double logCosh = std::abs(t) + std::log1p(std::exp(-2 * std::abs(t))) - std::log(2.0);
+                d.uy = field.misfit * 0.5 * (y - field.position + w * logCosh);
+                break;
+            }
+            case FieldType::DislocationDipole:
+            {
+                double bx = field.burgersX, by = field.burgersY;
+                if (bx == 0 && by == 0)
+                {
+                    bx = a1.x;
+                    by = a1.y;
+                }
+
+                // worked out with the Burgers vector along x' then rotated back, grad u = R grad' u' R^T
+                double b = std::sqrt(bx * bx + by * by);
+                double c = bx / b, s = by / b;
+
+                Displacement dipole;
+                for (int k = 0; k < 2; ++k)
+                {
+                    double cx = (k == 0 ? -0.5 : 0.5) * field.separation;
+                    double px = x - cx, py = y;
+                    dipole += EdgeDislocation(c * px + s * py, -s * px + c * py, b, field.poisson, k == 0 ? 1.0 : -1.0);
+                }
+
+                d.ux = c * dipole.ux - s * dipole.uy;
+                d.uy = s * dipole.ux + c * dipole.uy;
+
+                Eigen::Matrix2d R, G;
+                R << c, -s, s, c;
+                G << dipole.uxx, dipole.uxy, dipole.uyx, dipole.uyy;
+                G = R * G * R.transpose();
+
+                d.uxx = G(0, 0);
+                d.uxy = G(0, 1);
+                d.uyx = G(1, 0);
+                d.uyy = G(1, 1);
+                break;
+            }
+        }
+
+        return d;
+    }
+
+    inline Sample Generate(const Settings &settings)
+    {
+        int rows = settings.rows, cols = settings.cols;
+
+        if (rows < 3 || cols < 3)
+            throw std::invalid_argument("Image too small.");
+
+        if (settings.depth < 1)
+            throw std::invalid_argument("Stack depth must be at least 1");
+
+        if (settings.gVectors.size() < 2)
+            throw std::invalid_argument("At least two g-vectors are needed");
+
+        const auto &gs = settings.gVectors;
+        auto a1 = FirstLatticeVector(gs);
+
+        Sample out;
+        for (auto &g : gs)
+            out.gVectors.emplace_back(g.x * cols, g.y * rows);
+
+        if (settings.reference)
+        {
+            out.exx.resize(rows, cols);
+            out.exy.resize(rows, cols);
+            out.eyx.resize(rows, cols);
+            out.eyy.resize(rows, cols);
+        }
+
+        out.images.assign(settings.depth, Eigen::MatrixXd(rows, cols));
+
+        double offset = static_cast<double>(gs.size());
+
+        // the displacement is only worked out once for each pixel, then used for all the slices
+        #pragma omp parallel for
+        for (int j = 0; j < rows; ++j)
+            for (int i = 0; i < cols; ++i)
+            {
+                double x = i - cols / 2;
+                double y = j - rows / 2;
+
+                Displacement d;
+                for (auto &field : settings.fields)
+                    d += FieldAt(field, x, y, a1);
+
+                if (settings.reference)
+                {
+                    out.exx(j, i) = d.uxx;
+                    out.exy(j, i) = d.uxy;
+                    out.eyx(j, i) = d.uyx;
+                    out.eyy(j, i) = d.uyy;
+                }
+
+                for (int k = 0; k < settings.depth; ++k)
+                {
+                    double v = offset;
+                    for (auto &g : gs)
+                        v += std::cos(2 * PI * (g.x * (x - k * settings.drift - d.ux) + g.y * (y - d.uy)));
+                    out.images[k](j, i) = v;
+                }
+            }
+
+        // one generator for everything (not in parallel) so the same settings always give the same images
+        if (settings.noise > 0)
+        {
+            std::mt19937_64 random(settings.seed);
+            std::normal_distribution<double> normal(0.0, settings.noise);
+
+            for (auto &image : out.images)
+                for (Eigen::Index p = 0; p < image.size(); ++p)
+                    image(p) += normal(random);
+        }
+
+        return out;
+    }
+
+    // sigma (FFT pixels) for a mask a sixth of the distance to the nearest spot, like the GUI's default
+    inline double SuggestedSigma(const Sample &sample)
+    {
+        double nearest = std::numeric_limits<double>::max();
+        for (auto &g : sample.gVectors)
+            nearest = std::min(nearest, std::sqrt(g.x * g.x + g.y * g.y));
+
+        return nearest / 6.0;
+    }
+
+    // the reference combined the same way GPA::calculateDistortion does for each mode, as exx, exy, eyx, eyy
+    inline std::array<Eigen::MatrixXd, 4> Reference(const Sample &sample, const std::string &mode)
+    {
+        auto zeros = Eigen::MatrixXd::Zero(sample.exx.rows(), sample.exx.cols());
+
+        if (mode == "Strain")
+        {
+            Eigen::MatrixXd shear = 0.5 * (sample.exy + sample.eyx);
+            return {sample.exx, shear, shear, sample.eyy};
+        }
+        else if (mode == "Rotation")
+            return {zeros, 0.5 * (sample.exy - sample.eyx), 0.5 * (sample.eyx - sample.exy), zeros};
+        else if (mode == "Dilitation")
+            return {sample.exx + sample.eyy, zeros, zeros, zeros};
+
+        return {sample.exx, sample.exy, sample.eyx, sample.eyy};
+    }
+}
+
+#endif // SYNTHETIC_H
@@ -0,0 +1,194 @@
+#include "tiledgpa.h"
+
+#include <memory>
+#include <stdexcept>
+#include <exception>
+#include <algorithm>
+#include <cmath>
+
+#include <omp.h>
+
+#include "gpa.h"
+#include "windows.h"
+
+TiledGPA::TiledGPA(std::int64_t rows, std::int64_t cols, int tileSize, int overlap) : _Sigma(0, 0)
+{
+    if (rows < 3 || cols < 3)
+        throw std::invalid_argument("Image too small.");
+
+    if (overlap < 0 || tileSize - 2 * overlap < 1)
+        throw std::invalid_argument("Tile overlap must be less than half the tile size");
+
+    _Rows = rows;
+    _Cols = cols;
+    _TileRows = std::min<std::int64_t>(tileSize, rows);
+    _TileCols = std::min<std::int64_t>(tileSize, cols);
+    _Overlap = overlap;
+}
+
+void TiledGPA::setGVectors(const std::vector<Coord2D<double>> &gs, const Coord2D<double> &sigma)
+{
+    if (gs.size() < 2)
+        throw std::invalid_argument("At least two g-vectors are needed");
+
+    if (sigma.x <= 0 || sigma.y <= 0)
+        throw std::invalid_argument("Mask sigma must be positive");
+
+    _GVectors = gs;
+    _Sigma = sigma;
+}
+
+int TiledGPA::SuggestedOverlap(double sigma)
+{
+    return 2 * static_cast<int>(std::ceil(3.0 / (2 * PI * sigma)));
+}
+
+int TiledGPA::SuggestedOverlap(const Coord2D<double> &sigma)
+{
+    return SuggestedOverlap(std::min(sigma.x, sigma.y));
+}
+
+std::vector<TiledGPA::Region> TiledGPA::getTiles() const
+{
+    // the middle parts of the tiles (that are kept) are all the same size, apart from the last in each direction
+    auto split = [this](std::int64_t size, std::int64_t tile)
+    {
+        std::vector<std::pair<std::int64_t, std::int64_t>> parts;
+
+        // a single tile covers the image, so all of it is kept
+        std::int64_t step = tile < size ? tile - 2 * _Overlap : size;
+
+        for (std::int64_t start = 0; start < size; start += step)
+            parts.emplace_back(start, std::min(step, size - start));
+
+        return parts;
+    };
+
+    std::vector<Region> tiles;
+    for (auto &r : split(_Rows, _TileRows))
+        for (auto &c : split(_Cols, _TileCols))
+        {
+            Region area;
+            area.row0 = r.first;
+            area.rows = r.second;
+            area.col0 = c.first;
+            area.cols = c.second;
+            tiles.push_back(area);
+        }
+
+    return tiles;
+}
+
+TiledGPA::Region TiledGPA::loadedArea(const Region &core) const
+{
+    // the overlap goes either side of the kept area, tiles at the edges are moved in so they are all the same size
+    Region area;
+    area.rows = _TileRows;
+    area.cols = _TileCols;
+    area.row0 = std::min(std::max(core.row0 - _Overlap, std::int64_t(0)), _Rows - _TileRows);
+    area.col0 = std::min(std::max(core.col0 - _Overlap, std::int64_t(0)), _Cols - _TileCols);
+    return area;
+}
+
+void TiledGPA::run(const Source &source, const Sink &sink, double angle, const std::string &mode, bool phases,
+                   int workers)
+{
+    if (_GVectors.size() < 2)
+        throw std::logic_error("g-vectors must be set before processing");
+
+    auto tiles = getTiles();
+
+    if (workers <= 0)
+        workers = omp_get_max_threads();
+    workers = std::max(1, std::min(workers, static_cast<int>(tiles.size())));
+
+    int tileRows = static_cast<int>(_TileRows);
+    int tileCols = static_cast<int>(_TileCols);
+
+    // one engine per worker, only the first makes plans (they are made one at a time), the rest use them as well
+    std::vector<std::unique_ptr<GPA>> engines;
+    engines.push_back(std::make_unique<GPA>(Eigen::MatrixXcd(tileRows, tileCols)));
+    for (int w = 1; w < workers; ++w)
+        engines.push_back(std::make_unique<GPA>(tileRows, tileCols, *engines[0]));
+
+    // the g-vectors are the same for every tile, but in the pixels of the tile FFT
+    for (auto &engine : engines)
+        for (int k = 0; k < static_cast<int>(_GVectors.size()); ++k)
+            engine->calculatePhase(k, _GVectors[k].x * tileCols, _GVectors[k].y * tileRows, _Sigma.x * tileCols,
+                                   _Sigma.y * tileRows);
+
+    // The image is multiplied by a taper so the tile edges don't streak across the FFT. This is kept to the outer half
+    // of the overlap as the mask spreads the taper inwards as well (and it would bias the phase of the results)
+    UtilsWindow::Window window(UtilsWindow::WindowType::EdgeSmooth, _Overlap / 2.0);
+
+    std::exception_ptr error;
+    bool failed = false;
+
+    #pragma omp parallel for num_threads(workers) schedule(dynamic, 1)
+    for (int t = 0; t < static_cast<int>(tiles.size()); ++t)
+    {
+        bool stop;
+        #pragma omp atomic read
+        stop = failed;
+        if (stop)
+            continue;
+
+        try
+        {
+            // the tile number is the frame on the timeline
+            UtilsTrace::FrameScope frame(t);
+            STRAINPP_TIME("tiled.tile");
+
+            // the threads are already split between the tiles
+            omp_set_num_threads(1);
+
+            GPA &engine = *engines[omp_get_thread_num()];
+            const Region &core = tiles[t];
+            Region area = loadedArea(core);
+
+            Eigen::MatrixXcd tile(tileRows, tileCols);
+
+            #pragma omp critical(tiledSource)
+            source(area, tile);
+
+            if (_Overlap > 1)
+                UtilsWindow::ApplyInPlace(window, tile);
+
+            // setting the origin before the image means the phases are only worked out once
+            for (int k = 0; k < engine.getPhaseCount(); ++k)
+                engine.getPhase(k)->setOrigin(static_cast<double>(area.col0), static_cast<double>(area.row0));
+
+            engine.updateImage(tile);
+            engine.calculateDistortion(angle, mode);
+
+            std::int64_t r0 = core.row0 - area.row0;
+            std::int64_t c0 = core.col0 - area.col0;
+
+            StrainOutputs::NamedImages results;
+            for (auto &o : StrainOutputs::Collect(engine, mode, false, angle))
+                results.emplace_back(o.first, o.second.block(r0, c0, core.rows, core.cols));
+
+            if (phases)
+                for (int k = 0; k < engine.getPhaseCount(); ++k)
+                    results.emplace_back("Phase " + std::to_string(k+1) + " " + StrainOutputs::PhaseOutputNames[5],
+                                         engine.getPhase(k)->getWrappedPhase().block(r0, c0, core.rows, core.cols));
+
+            #pragma omp critical(tiledSink)
+            sink(core, results);
+        }
+        catch (...)
+        {
+            #pragma omp critical(tiledError)
+            {
+                if (!error)
+                    error = std::current_exception();
+            }
+
+            #pragma omp atomic write
+            failed = true;
+        }
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
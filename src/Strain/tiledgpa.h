@@ -0,0 +1,79 @@
+#ifndef TILEDGPA_H
+#define TILEDGPA_H
+
+#ifndef EIGEN_DEFAULT_TO_ROW_MAJOR
+#define EIGEN_DEFAULT_TO_ROW_MAJOR
+#endif
+
+#ifndef EIGEN_INITIALIZE_MATRICES_BY_ZERO
+#define EIGEN_INITIALIZE_MATRICES_BY_ZERO
+#endif
+
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+#include <Eigen/Dense>
+#include "coord.h"
+#include "outputs.h"
+
+// GPA for images that are too big to have in memory along with all their FFTs (e.g. stitched montages). The image is
+// done in overlapping tiles, each with its own (windowed) FFT. The g-vectors are fixed for every tile and each tile's
+// phase is measured from the origin of the whole image so they all fit together. Only the middle of each tile is kept,
+// the overlap is there so the tile edges (and the window) don't reach it.
+// Memory use only depends on the tile size (and the number of workers), the image only ever goes through the callbacks
+class TiledGPA
+{
+public:
+    // part of the image, in the engine's coordinates (row 0 at the bottom)
+    struct Region
+    {
+        std::int64_t row0 = 0, col0 = 0, rows = 0, cols = 0;
+    };
+
+    // fills 'tile' (already the right size) with the area of the image. Only ever called by one thread at a time
+    typedef std::function<void(const Region &area, Eigen::MatrixXcd &tile)> Source;
+
+    // gets the results for an area of the image, with the names from StrainOutputs::Collect (plus the normalised phases
+    // if they were asked for). Only ever called by one thread at a time, but the areas come in any order
+    typedef std::function<void(const Region &area, const StrainOutputs::NamedImages &results)> Sink;
+
+    // tiles are tileSize square (or the image size if that is smaller) and overlap each of their neighbours by
+    // 2 * overlap pixels. The outer half of the overlap is tapered to 0
+    TiledGPA(std::int64_t rows, std::int64_t cols, int tileSize, int overlap);
+
+    // g-vectors and sigma in cycles per pixel (i.e. FFT pixels divided by the FFT size). For the same mask as the whole
+    // image, sigma is its sigma (FFT pixels) over the columns in x and over the rows in y. At least 2 g-vectors are needed
+    void setGVectors(const std::vector<Coord2D<double>> &gs, const Coord2D<double> &sigma);
+
+    // the areas the results are given for, these cover the image without overlapping
+    std::vector<Region> getTiles() const;
+
+    // workers is the number of tiles done at once (0 for one per thread)
+    void run(const Source &source, const Sink &sink, double angle, const std::string &mode, bool phases = false,
+             int workers = 0);
+
+    Coord2D<std::int64_t> getTileSize() const {return Coord2D<std::int64_t>(_TileCols, _TileRows);}
+
+    // The mask is the same as blurring the phase with a Gaussian of 1 / (2 pi sigma) pixels, so anything at the tile
+    // edges reaches about 3 times that far in. The window takes up the outer half of the overlap, so this is twice that
+    static int SuggestedOverlap(double sigma);
+
+    // the overlap for the wider of the blurs in x and y
+    static int SuggestedOverlap(const Coord2D<double> &sigma);
+
+private:
+    std::int64_t _Rows, _Cols, _TileRows, _TileCols;
+
+    int _Overlap;
+
+    std::vector<Coord2D<double>> _GVectors;
+
+    Coord2D<double> _Sigma;
+
+    // start of the tile that has the results for 'core' in it
+    Region loadedArea(const Region &core) const;
+};
+
+#endif // TILEDGPA_H
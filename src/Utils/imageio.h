@@ -0,0 +1,507 @@
+#ifndef IMAGEIO_H
+#define IMAGEIO_H
+
+#ifndef EIGEN_DEFAULT_TO_ROW_MAJOR
+#define EIGEN_DEFAULT_TO_ROW_MAJOR
+#endif
+
+#ifndef EIGEN_INITIALIZE_MATRICES_BY_ZERO
+#define EIGEN_INITIALIZE_MATRICES_BY_ZERO
+#endif
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include "tiffio.h"
+#include "dmreader.h"
+#include "stats.h"
+
+#include <Eigen/Dense>
+
+// Loading images, these throw std::runtime_error with a message fit for showing to the user.
+// Images are flipped on loading so that the first row is the bottom of the image (as it is plotted)
+namespace UtilsIO {
+
+    template <typename T>
+    inline Eigen::MatrixXcd ReadTiffFrame(TIFF* tif)
+    {
+        STRAINPP_TIME("tiff.read");
+
+        uint32 imagelength = 0;
+        TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &imagelength);
+        tsize_t scanline = TIFFScanlineSize(tif);
+        auto width = static_cast<uint32>(scanline / sizeof(T));
+
+        // image too small to differentiate
+        if (imagelength < 3 || width < 3)
+            throw std::runtime_error("Image too small.");
+
+        Eigen::MatrixXcd frame(imagelength, width);
+
+        // the scanlines go in from the bottom up so the image doesn't need flipping afterwards
+        std::vector<T> buf(width);
+        for (uint32 row = 0; row < imagelength; ++row)
+        {
+            TIFFReadScanline(tif, &buf[0], row);
+            auto out = frame.row(imagelength - 1 - row);
+            for (uint32 col = 0; col < width; ++col)
+                out(col) = static_cast<double>(buf[col]);
+        }
+
+        return frame;
+    }
+
+    // calls f with a null pointer to the sample type of the current directory (e.g. f((uint16*)nullptr))
+    template <typename F>
+    inline auto WithSampleType(TIFF* tif, F f)
+    {
+        // this is defaulting to 1 according to: https://www.awaresystems.be/imaging/tiff/tifftags/samplesperpixel.html
+        uint16 samples = 1;
+        TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
+
+        if (samples != 1)
+            throw std::runtime_error("TIFF must be greyscale");
+
+        uint16 format = SAMPLEFORMAT_UINT;
+        TIFFGetField(tif, TIFFTAG_SAMPLEFORMAT, &format);
+
+        uint16 bitsper = 1;
+        TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &bitsper);
+
+        if (format == SAMPLEFORMAT_UINT)
+        {
+            if (bitsper == 8)
+                return f(static_cast<uint8*>(nullptr));
+            else if (bitsper == 16)
+                return f(static_cast<uint16*>(nullptr));
+            else if(bitsper == 32)
+                return f(static_cast<uint32*>(nullptr));
+            else if (bitsper == 64)
+                return f(static_cast<uint64*>(nullptr));
+        }
+        else if (format == SAMPLEFORMAT_INT)
+        {
+            if (bitsper == 8)
+                return f(static_cast<int8*>(nullptr));
+            else if (bitsper == 16)
+                return f(static_cast<int16*>(nullptr));
+            else if(bitsper == 32)
+                return f(static_cast<int32*>(nullptr));
+            else if (bitsper == 64)
+                return f(static_cast<int64*>(nullptr));
+        }
+        else if (format == SAMPLEFORMAT_IEEEFP)
+        {
+            if(bitsper == 32)
+                return f(static_cast<float*>(nullptr));
+            else if (bitsper == 64)
+                return f(static_cast<double*>(nullptr));
+        }
+
+        throw std::runtime_error("Unsupported TIFF format");
+    }
+
+    // reads the current directory of the tiff
+    inline Eigen::MatrixXcd ReadTiffFrame(TIFF* tif)
+    {
+        return WithSampleType(tif, [tif](auto type)
+        {
+            return ReadTiffFrame<std::remove_pointer_t<decltype(type)>>(tif);
+        });
+    }
+
+    // reads every directory of an open tiff
+    inline std::vector<Eigen::MatrixXcd> ReadTiff(TIFF* tif)
+    {
+        if (tif == nullptr)
+            throw std::runtime_error("Error opening TIFF");
+
+        std::vector<Eigen::MatrixXcd> images;
+
+        do {
+            images.push_back(ReadTiffFrame(tif));
+        } while (TIFFReadDirectory(tif));
+
+        return images;
+    }
+
+    // Reads areas of one frame of a tiff without reading the rest of it, for images too big to load (the tiled GPA).
+    // The strips (or tiles) of the file are decoded when they are first needed and the most recently used are kept, up
+    // to cachePixels of them, so reading along a band of rows only decodes each strip once. Only for one thread at a time
+    class TiffAreaReader
+    {
+    public:
+        // the current directory of 'tif', which must stay open (and on this directory) while this is used
+        TiffAreaReader(TIFF* tif, std::int64_t cachePixels) : _Tif(tif), _CachePixels(cachePixels), _Cached(0), _Used(0)
+        {
+            uint32 length = 0, width = 0;
+            TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &length);
+            TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+
+            if (length < 3 || width < 3)
+                throw std::runtime_error("Image too small.");
+
+            _Rows = length;
+            _Cols = width;
+
+            _Tiled = TIFFIsTiled(tif) != 0;
+            if (_Tiled)
+            {
+                TIFFGetField(tif, TIFFTAG_TILELENGTH, &_BlockRows);
+                TIFFGetField(tif, TIFFTAG_TILEWIDTH, &_BlockCols);
+            }
+            else
+            {
+                _BlockRows = length;
+                TIFFGetField(tif, TIFFTAG_ROWSPERSTRIP, &_BlockRows);
+                _BlockRows = std::min(_BlockRows, length);
+                _BlockCols = width;
+            }
+
+            // this also checks the format can be read
+            _SampleBytes = WithSampleType(tif, [](auto type) {return sizeof(*type);});
+            _Convert = WithSampleType(tif, [](auto type) -> void (*)(const unsigned char*, std::size_t, double*)
+            {
+                return [](const unsigned char *in, std::size_t n, double *out)
+                {
+                    typedef std::remove_pointer_t<decltype(type)> T;
+                    for (std::size_t i = 0; i < n; ++i)
+                    {
+                        T value;
+                        std::memcpy(&value, in + i * sizeof(T), sizeof(T));
+                        out[i] = static_cast<double>(value);
+                    }
+                };
+            });
+        }
+
+        std::int64_t rows() const {return _Rows;}
+
+        std::int64_t cols() const {return _Cols;}
+
+        // the area starting at (row0, col0) in the engine's coordinates (row 0 at the bottom), the size of 'out'
+        void read(std::int64_t row0, std::int64_t col0, Eigen::MatrixXcd &out)
+        {
+            STRAINPP_TIME("tiff.read_area");
+
+            std::int64_t rows = out.rows(), cols = out.cols();
+            if (row0 < 0 || col0 < 0 || row0 + rows > _Rows || col0 + cols > _Cols)
+                throw std::runtime_error("Area is outside the image");
+
+            // rows of the file, which go from the top down
+            std::int64_t top = _Rows - row0 - rows;
+            std::int64_t bottom = _Rows - 1 - row0;
+
+            for (std::int64_t by = top / _BlockRows; by <= bottom / _BlockRows; ++by)
+                for (std::int64_t bx = col0 / _BlockCols; bx <= (col0 + cols - 1) / _BlockCols; ++bx)
+                {
+                    const Block &block = getBlock(by, bx);
+
+                    std::int64_t r0 = std::max(top, block.row0), r1 = std::min(bottom + 1, block.row0 + _BlockRows);
+                    std::int64_t c0 = std::max(col0, block.col0), c1 = std::min(col0 + cols, block.col0 + _BlockCols);
+
+                    for (std::int64_t r = r0; r < r1; ++r)
+                    {
+                        const double *in = &block.data[(r - block.row0) * _BlockCols];
+                        auto line = out.row(_Rows - 1 - r - row0);
+                        for (std::int64_t c = c0; c < c1; ++c)
+                            line(c - col0) = in[c - block.col0];
+                    }
+                }
+
+            evict();
+        }
+
+    private:
+        // decoded strip or tile, the full size of one (tiles at the edges are padded out in the file as well)
+        struct Block
+        {
+            std::int64_t row0 = 0, col0 = 0;
+            std::vector<double> data;
+            unsigned long used = 0;
+        };
+
+        const Block &getBlock(std::int64_t by, std::int64_t bx)
+        {
+            uint32 index = _Tiled ? TIFFComputeTile(_Tif, static_cast<uint32>(bx * _BlockCols),
+                                                    static_cast<uint32>(by * _BlockRows), 0, 0)
+                                  : static_cast<uint32>(by);
+
+            Block &block = _Blocks[index];
+            block.used = ++_Used;
+
+            if (!block.data.empty())
+            {
+                STRAINPP_COUNT("tiff.block_cache_hits", 1);
+                return block;
+            }
+
+            std::size_t pixels = static_cast<std::size_t>(_BlockRows) * _BlockCols;
+            tsize_t size = _Tiled ? TIFFTileSize(_Tif) : TIFFStripSize(_Tif);
+            std::vector<unsigned char> raw(std::max<std::size_t>(size, 1));
+
+            tsize_t got = _Tiled ? TIFFReadEncodedTile(_Tif, index, &raw[0], size)
+                                 : TIFFReadEncodedStrip(_Tif, index, &raw[0], size);
+            if (got < 0)
+            {
+                _Blocks.erase(index);
+                throw std::runtime_error("Could not read TIFF data");
+            }
+
+            block.row0 = by * _BlockRows;
+            block.col0 = bx * _BlockCols;
+            block.data.assign(pixels, 0.0);
+
+            // the last strip can be shorter than the others
+            _Convert(&raw[0], std::min<std::size_t>(pixels, got / _SampleBytes), &block.data[0]);
+
+            _Cached += static_cast<std::int64_t>(pixels);
+            return block;
+        }
+
+        // least recently used first (a read always keeps all the blocks it needs until it is done, even over the limit)
+        void evict()
+        {
+            std::int64_t blockPixels = static_cast<std::int64_t>(_BlockRows) * _BlockCols;
+
+            while (_Cached > _CachePixels && _Blocks.size() > 1)
+            {
+                auto oldest = _Blocks.begin();
+                for (auto it = _Blocks.begin(); it != _Blocks.end(); ++it)
+                    if (it->second.used < oldest->second.used)
+                        oldest = it;
+
+                _Blocks.erase(oldest);
+                _Cached -= blockPixels;
+            }
+        }
+
+        TIFF* _Tif;
+
+        std::int64_t _Rows, _Cols;
+
+        bool _Tiled;
+        uint32 _BlockRows, _BlockCols;
+
+        std::size_t _SampleBytes;
+        void (*_Convert)(const unsigned char*, std::size_t, double*);
+
+        std::map<uint32, Block> _Blocks;
+        std::int64_t _CachePixels, _Cached;
+        unsigned long _Used;
+    };
+
+    inline std::vector<Eigen::MatrixXcd> ReadDM(DMRead::DMReader &dmFile)
+    {
+        // get image data first as this catches some errors in a more sensible way
+        // (e.g. binary images have no dimensions somehow....
+        std::vector<double> image = dmFile.getImage();
+
+        // get important image info
+        int nx, ny, nz;
+        try {
+            nx = dmFile.getX();
+            ny = dmFile.getY();
+            nz = dmFile.getZ();
+        } catch (const std::exception& e) {
+            throw std::runtime_error("Image dimensions not found.");
+        }
+
+        if (nx < 3 || ny < 3)
+            throw std::runtime_error("Image too small.");
+
+        dmFile.close();
+
+        // image is complex for FFTing later
+        std::vector<Eigen::MatrixXcd> complexImage(nz, Eigen::MatrixXcd(ny, nx));
+
+        // rows are copied in from the bottom up so the image doesn't need flipping afterwards
+        for (int k = 0; k < nz; ++k)
+        {
+            const double *frame = &image[static_cast<size_t>(k) * nx * ny];
+
+            #pragma omp parallel for
+            for (Eigen::Index j = 0; j < ny; ++j)
+            {
+                auto out = complexImage[k].row(ny - 1 - j);
+                for (Eigen::Index i = 0; i < nx; ++i)
+                    out(i) = frame[j * nx + i];
+            }
+        }
+
+        return complexImage;
+    }
+}
+
+// These write the same files as the plot exports, but straight from the data so they can be used away from the GUI
+// thread. Like the plots, the images are written 'upside down' (the first row of the matrix is the bottom of the image)
+namespace UtilsIO {
+
+    inline void WriteTiffData(const std::string &filepath, const Eigen::MatrixXd &data)
+    {
+        TIFF* out(TIFFOpen(filepath.c_str(), "w"));
+
+        if (!out)
+            throw std::runtime_error("Unable to write tif file");
+
+        auto sx = static_cast<uint32>(data.cols());
+        auto sy = static_cast<uint32>(data.rows());
+
+        TIFFSetField(out, TIFFTAG_IMAGEWIDTH, sx);
+        TIFFSetField(out, TIFFTAG_IMAGELENGTH, sy);
+        TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, static_cast<uint16>(1));
+        TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, static_cast<uint16>(sizeof(float)*8));
+        TIFFSetField(out, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
+        TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, sy);
+        TIFFSetField(out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+        TIFFSetField(out, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+        TIFFSetField(out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+
+        // virtually nothing supports 64-bit tiff so we will convert it here.
+        std::vector<float> buffer(data.size());
+
+        #pragma omp parallel for
+        for (Eigen::Index i = 0; i < data.rows(); ++i)
+            for (Eigen::Index j = 0; j < data.cols(); ++j)
+                buffer[i*data.cols() + j] = static_cast<float>(data(data.rows()-1-i, j));
+
+        tsize_t image_s = TIFFWriteEncodedStrip(out, 0, &buffer[0], sizeof(float)*buffer.size());
+        (void)TIFFClose(out);
+
+        if (image_s == -1)
+            throw std::runtime_error("Unable to write tif file");
+    }
+
+    inline void WriteBinary(const std::string &filepath, const Eigen::MatrixXd &data)
+    {
+        std::ofstream out(filepath, std::ios::out | std::ios::binary);
+        if (!out)
+            throw std::runtime_error("Unable to write binary file");
+
+        // rows are contiguous so can be written straight out, bottom row first
+        for (Eigen::Index i = data.rows() - 1; i >= 0; --i)
+            out.write(reinterpret_cast<const char*>(data.row(i).data()), data.cols()*sizeof(double));
+
+        out.close();
+    }
+
+    // 0 is an RGB image, which needs the plots so is not handled here
+    inline void WriteSelector(const std::string &filepath, const Eigen::MatrixXd &data, int choice)
+    {
+        if (choice == 1)
+            WriteTiffData(filepath + ".tif", data);
+        else if (choice == 2)
+            WriteBinary(filepath + ".bin", data);
+    }
+
+    // Writes an image a few whole rows at a time, in any order, so it never has to all be in memory (the tiled GPA).
+    // The files are the same as WriteSelector's, but tiffs have a strip for each row (and are BigTIFF if they need it)
+    class RowWriter
+    {
+    public:
+        RowWriter(const std::string &filepath, std::int64_t rows, std::int64_t cols, int choice)
+            : _Tif(nullptr), _Rows(rows), _Cols(cols)
+        {
+            if (choice == 1)
+            {
+                // classic tiffs have 32-bit offsets, this leaves plenty of room for the tags
+                bool big = rows * cols * static_cast<std::int64_t>(sizeof(float)) > (std::int64_t(1) << 31);
+
+                _Tif = TIFFOpen((filepath + ".tif").c_str(), big ? "w8" : "w");
+                if (!_Tif)
+                    throw std::runtime_error("Unable to write tif file");
+
+                TIFFSetField(_Tif, TIFFTAG_IMAGEWIDTH, static_cast<uint32>(cols));
+                TIFFSetField(_Tif, TIFFTAG_IMAGELENGTH, static_cast<uint32>(rows));
+                TIFFSetField(_Tif, TIFFTAG_SAMPLESPERPIXEL, static_cast<uint16>(1));
+                TIFFSetField(_Tif, TIFFTAG_BITSPERSAMPLE, static_cast<uint16>(sizeof(float)*8));
+                TIFFSetField(_Tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
+                TIFFSetField(_Tif, TIFFTAG_ROWSPERSTRIP, static_cast<uint32>(1));
+                TIFFSetField(_Tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+                TIFFSetField(_Tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+                TIFFSetField(_Tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+            }
+            else if (choice == 2)
+            {
+                _Binary.open(filepath + ".bin", std::ios::out | std::ios::binary | std::ios::trunc);
+                if (!_Binary)
+                    throw std::runtime_error("Unable to write binary file");
+            }
+            else
+                throw std::runtime_error("Only data can be written a part at a time");
+        }
+
+        ~RowWriter()
+        {
+            if (_Tif)
+                TIFFClose(_Tif);
+        }
+
+        RowWriter(const RowWriter&) = delete;
+        RowWriter &operator=(const RowWriter&) = delete;
+
+        // rows row0 to row0 + block.rows() of the image (the engine's coordinates), with all the columns
+        void write(std::int64_t row0, const Eigen::MatrixXd &block)
+        {
+            STRAINPP_TIME("io.write_rows");
+
+            if (block.cols() != _Cols || row0 < 0 || row0 + block.rows() > _Rows)
+                throw std::runtime_error("Rows are outside the image");
+
+            std::vector<float> buffer(_Tif ? _Cols : 0);
+
+            // the files are 'upside down' like the others, so the first row of the file is the last of the image
+            for (Eigen::Index r = 0; r < block.rows(); ++r)
+            {
+                std::int64_t line = _Rows - 1 - (row0 + r);
+
+                if (_Tif)
+                {
+                    for (Eigen::Index c = 0; c < _Cols; ++c)
+                        buffer[c] = static_cast<float>(block(r, c));
+
+                    if (TIFFWriteEncodedStrip(_Tif, static_cast<uint32>(line), &buffer[0], _Cols * sizeof(float)) == -1)
+                        throw std::runtime_error("Unable to write tif file");
+                }
+                else
+                {
+                    _Binary.seekp(line * _Cols * static_cast<std::int64_t>(sizeof(double)));
+                    _Binary.write(reinterpret_cast<const char*>(block.row(r).data()), _Cols * sizeof(double));
+                    if (!_Binary)
+                        throw std::runtime_error("Unable to write binary file");
+                }
+            }
+        }
+
+        // finishes the file, everything should have been written by now
+        void close()
+        {
+            if (_Tif)
+            {
+                TIFF* tif = _Tif;
+                _Tif = nullptr;
+                TIFFClose(tif);
+            }
+            else if (_Binary.is_open())
+            {
+                _Binary.close();
+                if (!_Binary)
+                    throw std::runtime_error("Unable to write binary file");
+            }
+        }
+
+    private:
+        TIFF* _Tif;
+        std::ofstream _Binary;
+
+        std::int64_t _Rows, _Cols;
+    };
+}
+
+#endif // IMAGEIO_H
@@ -0,0 +1,195 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <future>
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <condition_variable>
+
+namespace UtilsJobs {
+
+    // thrown out of a job when it notices it has been cancelled
+    class Cancelled : public std::runtime_error
+    {
+    public:
+        Cancelled() : std::runtime_error("Cancelled") {}
+    };
+
+    // Shared between a job and whoever started it. The job says what it is doing (and how far through it is) and
+    // checks if it should stop, anything else can cancel it. Cancelling only takes effect when the job next checks, so
+    // a single long engine call still runs to the end
+    class Progress
+    {
+    public:
+        // called (from the job's thread) whenever the stage or count changes, total is 0 if it isn't known
+        typedef std::function<void(const std::string &stage, size_t done, size_t total)> Callback;
+
+        explicit Progress(Callback callback = nullptr) : _Callback(std::move(callback)), _Cancelled(false) {}
+
+        void setStage(const std::string &stage, size_t total = 0)
+        {
+            checkCancelled();
+
+            {
+                std::lock_guard<std::mutex> lock(_Mutex);
+                _Stage = stage;
+                _Done = 0;
+                _Total = total;
+            }
+            report();
+        }
+
+        // one more of the current stage's total is done
+        void step()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_Mutex);
+                ++_Done;
+            }
+            report();
+        }
+
+        void cancel() {_Cancelled = true;}
+
+        bool isCancelled() const {return _Cancelled;}
+
+        void checkCancelled() const
+        {
+            if (_Cancelled)
+                throw Cancelled();
+        }
+
+    private:
+        void report()
+        {
+            if (!_Callback)
+                return;
+
+            std::string stage;
+            size_t done, total;
+            {
+                std::lock_guard<std::mutex> lock(_Mutex);
+                stage = _Stage;
+                done = _Done;
+                total = _Total;
+            }
+            _Callback(stage, done, total);
+        }
+
+        Callback _Callback;
+
+        std::atomic<bool> _Cancelled;
+
+        std::mutex _Mutex;
+        std::string _Stage;
+        size_t _Done = 0, _Total = 0;
+    };
+
+    // what submit gives back, the future has any exception the job threw (including Cancelled)
+    struct Job
+    {
+        std::shared_ptr<Progress> progress;
+        std::future<void> result;
+    };
+
+    // A single background thread that works through jobs in the order they were given. Only having the one thread
+    // means jobs never run at the same time, so they can all use the same engine without locking
+    class Worker
+    {
+    public:
+        typedef std::function<void(Progress&)> Function;
+
+        Worker() : _Stop(false), _Thread([this]{ loop(); }) {}
+
+        // anything still waiting is cancelled, but the one that is running has to finish (or notice it is cancelled)
+        ~Worker()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_Mutex);
+                _Stop = true;
+                for (auto &item : _Queue)
+                    item.progress->cancel();
+            }
+            _Wake.notify_all();
+
+            if (_Thread.joinable())
+                _Thread.join();
+        }
+
+        Worker(const Worker&) = delete;
+        Worker &operator=(const Worker&) = delete;
+
+        Job submit(Function function, Progress::Callback callback = nullptr)
+        {
+            Item item;
+            item.function = std::move(function);
+            item.progress = std::make_shared<Progress>(std::move(callback));
+
+            Job job;
+            job.progress = item.progress;
+            job.result = item.promise.get_future();
+
+            {
+                std::lock_guard<std::mutex> lock(_Mutex);
+                _Queue.push_back(std::move(item));
+            }
+            _Wake.notify_one();
+
+            return job;
+        }
+
+    private:
+        struct Item
+        {
+            Function function;
+            std::shared_ptr<Progress> progress;
+            std::promise<void> promise;
+        };
+
+        void loop()
+        {
+            while (true)
+            {
+                Item item;
+                {
+                    std::unique_lock<std::mutex> lock(_Mutex);
+                    _Wake.wait(lock, [this]{ return _Stop || !_Queue.empty(); });
+
+                    if (_Queue.empty())
+                        return;
+
+                    item = std::move(_Queue.front());
+                    _Queue.pop_front();
+                }
+
+                // always called, even if it was cancelled while it was waiting, so whoever submitted it still hears
+                // back (checking the progress first will throw Cancelled straight away)
+                try
+                {
+                    item.function(*item.progress);
+                    item.promise.set_value();
+                }
+                catch (...)
+                {
+                    item.promise.set_exception(std::current_exception());
+                }
+            }
+        }
+
+        std::mutex _Mutex;
+        std::condition_variable _Wake;
+        std::deque<Item> _Queue;
+        bool _Stop;
+
+        // last so everything else is set up before it starts
+        std::thread _Thread;
+    };
+}
+
+#endif // JOBS_H
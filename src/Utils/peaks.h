@@ -0,0 +1,165 @@
+#ifndef PEAKS_H
+#define PEAKS_H
+
+#ifndef EIGEN_DEFAULT_TO_ROW_MAJOR
+#define EIGEN_DEFAULT_TO_ROW_MAJOR
+#endif
+
+#ifndef EIGEN_INITIALIZE_MATRICES_BY_ZERO
+#define EIGEN_INITIALIZE_MATRICES_BY_ZERO
+#endif
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <Eigen/Dense>
+
+// Finding the Bragg spots on a power spectrum without anyone clicking on them.
+// Positions are relative to the centre of the FFT (same as the GUI) with y going up the matrix rows
+namespace UtilsPeaks {
+
+    struct Peak
+    {
+        double x = 0, y = 0;
+
+        // value of the power spectrum at the peak (i.e. log10(1 + |FFT|))
+        double intensity = 0;
+    };
+
+    // Local maxima of the power spectrum that are the largest within nmsRadius pixels, are further than minRadius from
+    // the centre and are more than 'sigmas' standard deviations above the mean. As the spectrum of a real image is
+    // symmetric only one of each Friedel pair is returned (the one in the upper half). Sorted strongest first
+    inline std::vector<Peak> FindPeaks(const Eigen::MatrixXd &ps, double minRadius, int nmsRadius = 3, double sigmas = 3.0)
+    {
+        int rows = static_cast<int>(ps.rows());
+        int cols = static_cast<int>(ps.cols());
+        int x0 = cols / 2;
+        int y0 = rows / 2;
+
+        double sum = 0, sum2 = 0;
+
+        #pragma omp parallel for reduction(+:sum,sum2)
+        for (int j = 0; j < rows; ++j)
+            for (int i = 0; i < cols; ++i)
+            {
+                sum += ps(j, i);
+                sum2 += ps(j, i) * ps(j, i);
+            }
+
+        double n = static_cast<double>(ps.size());
+        double mean = sum / n;
+        double threshold = mean + sigmas * std::sqrt(std::max(0.0, sum2 / n - mean * mean));
+
+        std::vector<Peak> peaks;
+
+        // stay far enough from the edges that the window is always inside the spectrum
+        int edge = std::max(nmsRadius, 1);
+
+        #pragma omp parallel
+        {
+            std::vector<Peak> local;
+
+            #pragma omp for nowait
+            for (int j = std::max(edge, y0); j < rows - edge; ++j)
+                for (int i = edge; i < cols - edge; ++i)
+                {
+                    double v = ps(j, i);
+                    if (v <= threshold)
+                        continue;
+
+                    int x = i - x0;
+                    int y = j - y0;
+
+                    // only keep one of each Friedel pair
+                    if (y == 0 && x <= 0)
+                        continue;
+
+                    if (x*x + y*y < minRadius*minRadius)
+                        continue;
+
+                    // ties go to the first in memory order so flat tops only give one peak
+                    bool isMax = true;
+                    for (int jj = j - nmsRadius; jj <= j + nmsRadius && isMax; ++jj)
+                        for (int ii = i - nmsRadius; ii <= i + nmsRadius; ++ii)
+                        {
+                            bool before = jj < j || (jj == j && ii < i);
+                            double w = ps(jj, ii);
+                            if ((before && w >= v) || (!before && w > v))
+                            {
+                                isMax = false;
+                                break;
+                            }
+                        }
+
+                    if (!isMax)
+                        continue;
+
+                    // parabola through the peak and its neighbours, in each direction
+                    double dx = 0, dy = 0;
+                    double cx = ps(j, i-1) - 2*v + ps(j, i+1);
+                    double cy = ps(j-1, i) - 2*v + ps(j+1, i);
+                    if (cx < 0)
+                        dx = 0.5 * (ps(j, i-1) - ps(j, i+1)) / cx;
+                    if (cy < 0)
+                        dy = 0.5 * (ps(j-1, i) - ps(j+1, i)) / cy;
+
+                    local.push_back({x + dx, y + dy, v});
+                }
+
+            #pragma omp critical
+            peaks.insert(peaks.end(), local.begin(), local.end());
+        }
+
+        // the order from the threads isn't fixed, so sort with a tie break on position to always give the same result
+        std::sort(peaks.begin(), peaks.end(), [](const Peak &a, const Peak &b)
+        {
+            if (a.intensity != b.intensity)
+                return a.intensity > b.intensity;
+            if (a.y != b.y)
+                return a.y < b.y;
+            return a.x < b.x;
+        });
+
+        return peaks;
+    }
+
+    // Picks a lattice basis from the strongest few peaks (maxCandidates of them): the shortest one, then the shortest
+    // that is at least minAngle (degrees) away from being parallel to it. Higher order spots can be as strong as the
+    // first order ones, so going for the shortest avoids ending up with e.g. g and 2g+g'. Returns false if there aren't
+    // two such peaks
+    inline bool SelectBasis(const std::vector<Peak> &peaks, Peak &first, Peak &second, double minAngle = 15.0,
+                            size_t maxCandidates = 8)
+    {
+        std::vector<Peak> candidates(peaks.begin(), peaks.begin() + std::min(peaks.size(), maxCandidates));
+
+        if (candidates.size() < 2)
+            return false;
+
+        std::stable_sort(candidates.begin(), candidates.end(), [](const Peak &a, const Peak &b)
+        {
+            return a.x*a.x + a.y*a.y < b.x*b.x + b.y*b.y;
+        });
+
+        first = candidates[0];
+        double limit = std::sin(minAngle * 3.14159265358979323846 / 180.0);
+        double len1 = std::sqrt(first.x*first.x + first.y*first.y);
+
+        for (size_t k = 1; k < candidates.size(); ++k)
+        {
+            const Peak &p = candidates[k];
+            double len2 = std::sqrt(p.x*p.x + p.y*p.y);
+            double cross = std::abs(first.x * p.y - first.y * p.x);
+
+            if (cross > limit * len1 * len2)
+            {
+                second = p;
+                return true;
+            }
+        }
+
+        return false;
+    }
+}
+
+#endif // PEAKS_H
@@ -0,0 +1,173 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <algorithm>
+
+namespace UtilsPipeline {
+
+    // simple blocking queue, push will wait when full so a fast producer can't run away with all the memory
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(size_t capacity) : _Capacity(std::max<size_t>(capacity, 1)), _Closed(false) {}
+
+        // returns false if the queue was closed before the item could be added
+        bool push(T item)
+        {
+            std::unique_lock<std::mutex> lock(_Mutex);
+            _NotFull.wait(lock, [this]{ return _Closed || _Items.size() < _Capacity; });
+
+            if (_Closed)
+                return false;
+
+            _Items.push_back(std::move(item));
+            _NotEmpty.notify_one();
+            return true;
+        }
+
+        // returns false once the queue is closed and there is nothing left to take
+        bool pop(T &item)
+        {
+            std::unique_lock<std::mutex> lock(_Mutex);
+            _NotEmpty.wait(lock, [this]{ return _Closed || !_Items.empty(); });
+
+            if (_Items.empty())
+                return false;
+
+            item = std::move(_Items.front());
+            _Items.pop_front();
+            _NotFull.notify_one();
+            return true;
+        }
+
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(_Mutex);
+            _Closed = true;
+            _NotEmpty.notify_all();
+            _NotFull.notify_all();
+        }
+
+    private:
+        size_t _Capacity;
+        bool _Closed;
+
+        std::deque<T> _Items;
+
+        std::mutex _Mutex;
+        std::condition_variable _NotEmpty, _NotFull;
+    };
+
+    // Three stage pipeline for working through stacks:
+    //   reader thread -> [queue] -> compute worker(s) -> [queue] -> writer thread
+    // so decoding, processing and writing to disk all overlap. Each compute worker gets its own index so it can
+    // own its own engine (FFTW plans are made one at a time, so it's best to make them before calling run)
+    template <typename Frame, typename Result>
+    class StackPipeline
+    {
+    public:
+        // fill in the frame for the given index, return false to stop reading early
+        typedef std::function<bool(size_t, Frame&)> ReadFunction;
+        typedef std::function<Result(size_t, Frame&, int)> ComputeFunction;
+        typedef std::function<void(size_t, Result&)> WriteFunction;
+
+        explicit StackPipeline(size_t depth = 2, int workers = 1) : _Depth(std::max<size_t>(depth, 1)), _Workers(std::max(workers, 1)) {}
+
+        // blocks until everything is written, the first exception thrown by any stage is rethrown here
+        void run(size_t count, ReadFunction read, ComputeFunction compute, WriteFunction write)
+        {
+            BoundedQueue<std::pair<size_t, Frame>> frames(_Depth);
+            BoundedQueue<std::pair<size_t, Result>> results(_Depth);
+
+            std::exception_ptr error;
+            std::mutex errorMutex;
+            std::atomic<bool> failed(false);
+
+            auto fail = [&](std::exception_ptr e)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                    error = e;
+                failed = true;
+                frames.close();
+                results.close();
+            };
+
+            std::thread reader([&]()
+            {
+                try
+                {
+                    for (size_t i = 0; i < count && !failed; ++i)
+                    {
+                        Frame frame;
+                        if (!read(i, frame) || !frames.push(std::make_pair(i, std::move(frame))))
+                            break;
+                    }
+                }
+                catch (...)
+                {
+                    fail(std::current_exception());
+                }
+                frames.close();
+            });
+
+            std::atomic<int> running(_Workers);
+            std::vector<std::thread> workers;
+            for (int w = 0; w < _Workers; ++w)
+                workers.emplace_back([&, w]()
+                {
+                    try
+                    {
+                        std::pair<size_t, Frame> item;
+                        while (!failed && frames.pop(item))
+                            if (!results.push(std::make_pair(item.first, compute(item.first, item.second, w))))
+                                break;
+                    }
+                    catch (...)
+                    {
+                        fail(std::current_exception());
+                    }
+                    // last worker out lets the writer know
+                    if (--running == 0)
+                        results.close();
+                });
+
+            std::thread writer([&]()
+            {
+                try
+                {
+                    std::pair<size_t, Result> item;
+                    while (!failed && results.pop(item))
+                        write(item.first, item.second);
+                }
+                catch (...)
+                {
+                    fail(std::current_exception());
+                }
+            });
+
+            reader.join();
+            for (auto &worker : workers)
+                worker.join();
+            writer.join();
+
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+    private:
+        size_t _Depth;
+        int _Workers;
+    };
+}
+
+#endif // PIPELINE_H
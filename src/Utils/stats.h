@@ -0,0 +1,278 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#include "trace.h"
+
+// Timings and counts for the slow parts (FFTs, masks, phases, differentials, file reading, plotting...) to see where
+// the time goes. Everything goes through the STRAINPP_TIME and STRAINPP_COUNT macros, which are nothing at all unless
+// STRAINPP_STATS is defined (the CMake option of the same name, on by default). Even then nothing is recorded until it
+// is turned on (SetEnabled, or the STRAINPP_STATS environment variable) so it costs one atomic load per timed block.
+//
+// Timers can be inside each other (e.g. the FFTs are also part of the phase they are for) and ones inside parallel
+// loops add up the time from each thread, so the totals don't add up to the wall time. The same timers also go on the
+// timeline when tracing is on (see trace.h)
+namespace UtilsStats {
+
+    // totals for one name, timers add their time as well as counting how many times they ran
+    struct Entry
+    {
+        Entry(const std::string &n, bool t) : name(n), timer(t), count(0), nanoseconds(0) {}
+
+        const std::string name;
+        const bool timer;
+        std::atomic<std::uint64_t> count;
+        std::atomic<std::uint64_t> nanoseconds;
+    };
+
+    struct Total
+    {
+        std::string name;
+        bool timer;
+        std::uint64_t count;
+        double seconds;
+    };
+
+    inline std::atomic<bool> &EnabledFlag()
+    {
+        static std::atomic<bool> enabled(std::getenv("STRAINPP_STATS") != nullptr);
+        return enabled;
+    }
+
+    inline bool Enabled()
+    {
+        return EnabledFlag().load(std::memory_order_relaxed);
+    }
+
+    inline void SetEnabled(bool enabled)
+    {
+        EnabledFlag() = enabled;
+    }
+
+    // entries are never removed, so a reference to one (kept in a static by the macros) stays good
+    class Registry
+    {
+    public:
+        static Registry &Instance()
+        {
+            static Registry registry;
+            return registry;
+        }
+
+        Entry &get(const std::string &name, bool timer)
+        {
+            std::lock_guard<std::mutex> lock(_Mutex);
+
+            auto &entry = _Entries[name];
+            if (!entry)
+                entry = std::make_unique<Entry>(name, timer);
+
+            return *entry;
+        }
+
+        // only the ones that have actually been used
+        std::vector<Total> totals()
+        {
+            std::lock_guard<std::mutex> lock(_Mutex);
+
+            std::vector<Total> out;
+            for (auto &e : _Entries)
+            {
+                Total t;
+                t.name = e.first;
+                t.timer = e.second->timer;
+                t.count = e.second->count;
+                t.seconds = e.second->nanoseconds * 1e-9;
+                if (t.count > 0)
+                    out.push_back(t);
+            }
+
+            return out;
+        }
+
+        void reset()
+        {
+            std::lock_guard<std::mutex> lock(_Mutex);
+
+            for (auto &e : _Entries)
+            {
+                e.second->count = 0;
+                e.second->nanoseconds = 0;
+            }
+        }
+
+    private:
+        Registry() = default;
+
+        std::mutex _Mutex;
+        std::map<std::string, std::unique_ptr<Entry>> _Entries;
+    };
+
+    class ScopedTimer
+    {
+    public:
+        explicit ScopedTimer(Entry &entry) : _Entry(Enabled() || UtilsTrace::Enabled() ? &entry : nullptr)
+        {
+            if (_Entry)
+                _Start = std::chrono::steady_clock::now();
+        }
+
+        ~ScopedTimer()
+        {
+            if (!_Entry)
+                return;
+
+            auto end = std::chrono::steady_clock::now();
+
+            if (Enabled())
+            {
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - _Start);
+                _Entry->count += 1;
+                _Entry->nanoseconds += static_cast<std::uint64_t>(ns.count());
+            }
+
+            // the name lives as long as the entry, which is forever
+            UtilsTrace::Record(_Entry->name.c_str(), _Start, end);
+        }
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer &operator=(const ScopedTimer&) = delete;
+
+    private:
+        Entry *_Entry;
+        std::chrono::steady_clock::time_point _Start;
+    };
+
+    inline void Add(Entry &entry, std::uint64_t n)
+    {
+        if (Enabled())
+            entry.count += n;
+    }
+
+    inline std::vector<Total> Totals()
+    {
+        return Registry::Instance().totals();
+    }
+
+    inline void Reset()
+    {
+        Registry::Instance().reset();
+    }
+
+    // table of everything, the timers with the most time first
+    inline std::string Summary()
+    {
+        auto totals = Totals();
+        std::stable_sort(totals.begin(), totals.end(), [](const Total &a, const Total &b)
+        {
+            return a.timer != b.timer ? a.timer : a.seconds > b.seconds;
+        });
+
+        std::ostringstream out;
+        out << std::left << std::setw(28) << "name" << std::right << std::setw(12) << "count"
+            << std::setw(14) << "total (s)" << std::setw(14) << "mean (ms)" << "\n";
+
+        for (auto &t : totals)
+        {
+            out << std::left << std::setw(28) << t.name << std::right << std::setw(12) << t.count;
+            if (t.timer)
+                out << std::fixed << std::setprecision(4) << std::setw(14) << t.seconds
+                    << std::setprecision(3) << std::setw(14) << 1e3 * t.seconds / t.count;
+            out << "\n";
+        }
+
+        return out.str();
+    }
+
+    // one line with the biggest few timers, for the status bar
+    inline std::string ShortSummary(size_t n = 3)
+    {
+        auto totals = Totals();
+        totals.erase(std::remove_if(totals.begin(), totals.end(), [](const Total &t) {return !t.timer;}), totals.end());
+        std::stable_sort(totals.begin(), totals.end(), [](const Total &a, const Total &b) {return a.seconds > b.seconds;});
+
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3);
+        for (size_t i = 0; i < std::min(n, totals.size()); ++i)
+            out << (i > 0 ? ", " : "") << totals[i].name << " " << totals[i].seconds << " s";
+
+        return out.str();
+    }
+
+    inline std::string JsonString(const std::string &text)
+    {
+        std::ostringstream out;
+        out << '"';
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+            else
+                out << c;
+        }
+        out << '"';
+        return out.str();
+    }
+
+    // {"timers": {"name": {"count": n, "seconds": s}, ...}, "counters": {"name": n, ...}}
+    inline std::string Json()
+    {
+        auto totals = Totals();
+
+        std::ostringstream timers, counters;
+        timers << std::setprecision(9);
+
+        for (auto &t : totals)
+        {
+            if (t.timer)
+                timers << (timers.tellp() > 0 ? ",\n" : "\n") << "    " << JsonString(t.name) << ": {\"count\": "
+                       << t.count << ", \"seconds\": " << t.seconds << "}";
+            else
+                counters << (counters.tellp() > 0 ? ",\n" : "\n") << "    " << JsonString(t.name) << ": " << t.count;
+        }
+
+        std::ostringstream out;
+        out << "{\n  \"timers\": {" << timers.str() << "\n  },\n  \"counters\": {" << counters.str() << "\n  }\n}\n";
+        return out.str();
+    }
+}
+
+#define STRAINPP_STATS_JOIN2(a, b) a##b
+#define STRAINPP_STATS_JOIN(a, b) STRAINPP_STATS_JOIN2(a, b)
+
+#ifdef STRAINPP_STATS
+
+// times the rest of the enclosing block
+#define STRAINPP_TIME(name) \
+    static UtilsStats::Entry &STRAINPP_STATS_JOIN(statsEntry_, __LINE__) = UtilsStats::Registry::Instance().get(name, true); \
+    UtilsStats::ScopedTimer STRAINPP_STATS_JOIN(statsTimer_, __LINE__)(STRAINPP_STATS_JOIN(statsEntry_, __LINE__))
+
+// n isn't worked out at all if the stats aren't built in
+#define STRAINPP_COUNT(name, n) \
+    do { \
+        static UtilsStats::Entry &statsEntry = UtilsStats::Registry::Instance().get(name, false); \
+        UtilsStats::Add(statsEntry, static_cast<std::uint64_t>(n)); \
+    } while (0)
+
+#else
+
+#define STRAINPP_TIME(name) do {} while (0)
+#define STRAINPP_COUNT(name, n) do {} while (0)
+
+#endif
+
+#endif // STATS_H
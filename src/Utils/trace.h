@@ -0,0 +1,191 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+
+// Timeline of everything timed with STRAINPP_TIME (see stats.h), with the thread and frame each one ran on, written out
+// as a Chrome trace (open it in chrome://tracing or ui.perfetto.dev). This is for seeing if stages overlap or wait on
+// each other, e.g. the phases of a frame or the reader/compute/writer threads of a stack.
+//
+// Events go into a fixed size ring buffer without any locks (each one takes the next slot with an atomic add), so when
+// it is full the oldest are overwritten. Start and Write must be called while nothing is being timed
+namespace UtilsTrace {
+
+    // a whole block, from when it started to when it ended
+    struct Event
+    {
+        const char *name = nullptr;
+        std::int64_t frame = -1;
+        std::uint32_t thread = 0;
+        std::int64_t start = 0, end = 0;
+    };
+
+    class Buffer
+    {
+    public:
+        explicit Buffer(size_t capacity) : _Events(std::max<size_t>(capacity, 1)), _Next(0),
+                                           _Origin(std::chrono::steady_clock::now()) {}
+
+        void record(const char *name, std::int64_t frame, std::uint32_t thread,
+                    std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+        {
+            size_t slot = _Next.fetch_add(1, std::memory_order_relaxed) % _Events.size();
+
+            Event &e = _Events[slot];
+            e.name = name;
+            e.frame = frame;
+            e.thread = thread;
+            e.start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - _Origin).count();
+            e.end = std::chrono::duration_cast<std::chrono::nanoseconds>(end - _Origin).count();
+        }
+
+        // oldest first, only what is still in the buffer
+        std::vector<Event> events() const
+        {
+            size_t next = _Next.load();
+            size_t n = std::min(next, _Events.size());
+
+            std::vector<Event> out;
+            out.reserve(n);
+            for (size_t i = next - n; i < next; ++i)
+                out.push_back(_Events[i % _Events.size()]);
+
+            return out;
+        }
+
+        size_t dropped() const
+        {
+            size_t next = _Next.load();
+            return next > _Events.size() ? next - _Events.size() : 0;
+        }
+
+    private:
+        std::vector<Event> _Events;
+        std::atomic<size_t> _Next;
+        std::chrono::steady_clock::time_point _Origin;
+    };
+
+    inline std::atomic<bool> &EnabledFlag()
+    {
+        static std::atomic<bool> enabled(false);
+        return enabled;
+    }
+
+    inline bool Enabled()
+    {
+        return EnabledFlag().load(std::memory_order_relaxed);
+    }
+
+    inline std::unique_ptr<Buffer> &CurrentBuffer()
+    {
+        static std::unique_ptr<Buffer> buffer;
+        return buffer;
+    }
+
+    // small numbers are easier to read in the viewer than the system's thread ids
+    inline std::uint32_t ThreadNumber()
+    {
+        static std::atomic<std::uint32_t> counter(0);
+        thread_local std::uint32_t number = counter++;
+        return number;
+    }
+
+    // the frame (slice, tile...) this thread is working on, -1 for none. Threads started inside (e.g. by OpenMP)
+    // don't know it, but they still show up on the timeline
+    inline std::int64_t &CurrentFrame()
+    {
+        thread_local std::int64_t frame = -1;
+        return frame;
+    }
+
+    // sets the frame for the events on this thread until it goes out of scope
+    class FrameScope
+    {
+    public:
+        explicit FrameScope(std::int64_t frame) : _Previous(CurrentFrame()) {CurrentFrame() = frame;}
+        ~FrameScope() {CurrentFrame() = _Previous;}
+
+        FrameScope(const FrameScope&) = delete;
+        FrameScope &operator=(const FrameScope&) = delete;
+
+    private:
+        std::int64_t _Previous;
+    };
+
+    // throws away anything from before, each event is about 40 bytes
+    inline void Start(size_t capacity = 1 << 20)
+    {
+        CurrentBuffer() = std::make_unique<Buffer>(capacity);
+        EnabledFlag() = true;
+    }
+
+    inline void Stop()
+    {
+        EnabledFlag() = false;
+    }
+
+    inline void Record(const char *name, std::chrono::steady_clock::time_point start,
+                       std::chrono::steady_clock::time_point end)
+    {
+        if (!Enabled())
+            return;
+
+        CurrentBuffer()->record(name, CurrentFrame(), ThreadNumber(), start, end);
+    }
+
+    inline std::string JsonString(const char *text)
+    {
+        std::string out = "\"";
+        for (const char *c = text; *c; ++c)
+        {
+            if (*c == '"' || *c == '\\')
+                out += '\\';
+            out += *c;
+        }
+        return out + "\"";
+    }
+
+    // stops recording and writes the Chrome trace event format (times are in microseconds)
+    inline void Write(const std::string &path)
+    {
+        Stop();
+
+        std::ofstream file(path);
+        if (!file)
+            throw std::runtime_error("Could not write trace file: " + path);
+
+        auto &buffer = CurrentBuffer();
+        auto events = buffer ? buffer->events() : std::vector<Event>();
+
+        file << std::fixed << std::setprecision(3);
+        file << "{\"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped\": " << (buffer ? buffer->dropped() : 0)
+             << "}, \"traceEvents\": [";
+
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            const Event &e = events[i];
+            file << (i > 0 ? ",\n" : "\n") << "{\"name\": " << JsonString(e.name) << ", \"cat\": \"strainpp\", "
+                 << "\"ph\": \"X\", \"pid\": 1, \"tid\": " << e.thread << ", \"ts\": " << e.start * 1e-3
+                 << ", \"dur\": " << (e.end - e.start) * 1e-3;
+            if (e.frame >= 0)
+                file << ", \"args\": {\"frame\": " << e.frame << "}";
+            file << "}";
+        }
+
+        file << "\n]}\n";
+
+        if (!file)
+            throw std::runtime_error("Could not write trace file: " + path);
+    }
+}
+
+#endif // TRACE_H
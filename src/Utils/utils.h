@@ -9,12 +9,14 @@
 #define EIGEN_INITIALIZE_MATRICES_BY_ZERO
 #endif
 
+#include <mutex>
 #include <memory>
 #include <vector>
 #include <cmath>
 #include "fftw3.h"
 
 #include <Eigen/Dense>
+#include "stats.h"
 
 #ifndef PI_H
 #define PI_H
@@ -29,41 +31,138 @@ using MatrixXT = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
 
 namespace UtilsFFT {
 
+    // (-1)^(i+j) * value, this is what shifts the zero frequency to the centre of the FFT. It is only ever a sign
+    // flip so is done without the pow, and can be fused into whatever loop is reading or writing the FFT data
     template <typename T>
-    static Eigen::MatrixXT<T> preFFTShift(Eigen::MatrixXT<T> &input)
+    inline T CentreShift(const T &value, Eigen::Index i, Eigen::Index j)
     {
-        Eigen::MatrixXT<T> output(input.rows(), input.cols());
+        return ((i + j) & 1) ? -value : value;
+    }
 
+    // in-place version, flips the sign of every other element (starting from the second one on odd rows)
+    template <typename T>
+    inline void preFFTShiftInPlace(Eigen::MatrixXT<T> &input)
+    {
         #pragma omp parallel for
-        for(int j = 0; j < input.rows(); ++j)
-            for(int i =0; i < input.cols(); ++i)
-                output(j, i) = std::pow(-1, i+j)*input(j, i);
+        for(Eigen::Index j = 0; j < input.rows(); ++j)
+            for(Eigen::Index i = j & 1; i < input.cols(); i += 2)
+                input(j, i) = -input(j, i);
+    }
 
+    template <typename T>
+    inline Eigen::MatrixXT<T> preFFTShift(const Eigen::MatrixXT<T> &input)
+    {
+        Eigen::MatrixXT<T> output(input);
+        preFFTShiftInPlace(output);
         return output;
     }
     
-    static void doFFTPlan(std::shared_ptr<fftw_plan> plan, Eigen::MatrixXcd in, Eigen::MatrixXcd& out, int dir)
+    // FFTW's planner is not thread safe (running the plans is), every plan is made through the MakePlans below so
+    // they all take this lock. It's function static so there is only one of it however many places include this, and
+    // recursive so it can also be held around a MakePlan (e.g. to change the number of threads the plan is for)
+    inline std::recursive_mutex &PlannerMutex()
+    {
+        static std::recursive_mutex planner;
+        return planner;
+    }
+
+    // 2D (row major) plan through the guru64 interface, the basic planner takes int sizes and works out the number of
+    // elements in int as well, so it overflows for images over 2^31 pixels
+    inline std::shared_ptr<fftw_plan> MakePlan(Eigen::Index rows, Eigen::Index cols, fftw_complex *in, fftw_complex *out, int sign)
+    {
+        STRAINPP_TIME("fft.plan");
+
+        fftw_iodim64 dims[2];
+        dims[0].n = rows;
+        dims[0].is = cols;
+        dims[0].os = cols;
+        dims[1].n = cols;
+        dims[1].is = 1;
+        dims[1].os = 1;
+
+        std::lock_guard<std::recursive_mutex> lock(PlannerMutex());
+        return std::make_shared<fftw_plan>(fftw_plan_guru64_dft(2, dims, 0, nullptr, in, out, sign, FFTW_ESTIMATE));
+    }
+
+    // FFTW_ESTIMATE doesn't touch the data, so the plans can be made without any (they are used with fftw_execute_dft)
+    inline std::shared_ptr<fftw_plan> MakePlan(Eigen::Index rows, Eigen::Index cols, int sign)
+    {
+        // I think I had an error when using NULL before as technically they are the same and FFTW tries to optimise
+        // for in-place FFTs..., These are just temporary to avoid that
+        fftw_complex temp_1 [1] = {};
+        fftw_complex temp_2 [1] = {};
+        return MakePlan(rows, cols, temp_1, temp_2, sign);
+    }
+
+    // The same plan, but to run on 'threads' threads whatever the program has set FFTW to. The planner's thread count
+    // is global and belongs to the program, so it is read first and put back afterwards. That needs
+    // fftw_planner_nthreads (FFTW 3.3.9), without it there is no plan
+    inline std::shared_ptr<fftw_plan> MakePlan(Eigen::Index rows, Eigen::Index cols, int sign, int threads)
+    {
+#ifdef STRAINPP_FFTW_PLANNER_NTHREADS
+        std::lock_guard<std::recursive_mutex> lock(PlannerMutex());
+
+        int previous = fftw_planner_nthreads();
+        fftw_plan_with_nthreads(threads);
+        auto plan = MakePlan(rows, cols, sign);
+        fftw_plan_with_nthreads(previous);
+
+        return plan;
+#else
+        (void)rows; (void)cols; (void)sign; (void)threads;
+        return nullptr;
+#endif
+    }
+
+    // 1D plan, made the same way (for transforming single rows or columns)
+    inline std::shared_ptr<fftw_plan> MakePlan(Eigen::Index n, int sign)
     {
+        STRAINPP_TIME("fft.plan");
+
+        fftw_iodim64 dims[1];
+        dims[0].n = n;
+        dims[0].is = 1;
+        dims[0].os = 1;
+
+        fftw_complex temp_1 [1] = {};
+        fftw_complex temp_2 [1] = {};
+
+        std::lock_guard<std::recursive_mutex> lock(PlannerMutex());
+        return std::make_shared<fftw_plan>(fftw_plan_guru64_dft(1, dims, 0, nullptr, temp_1, temp_2, sign, FFTW_ESTIMATE));
+    }
+
+    inline void doFFTPlan(std::shared_ptr<fftw_plan> plan, const Eigen::MatrixXcd &in, Eigen::MatrixXcd& out, int dir)
+    {
+        STRAINPP_TIME("fft.execute");
+
+        // the plans are all out of place, so can run straight on the matrices as long as they are different
+        if (plan && in.data() != out.data()) {
+            out.resize(in.rows(), in.cols());
+            fftw_execute_dft(*plan, reinterpret_cast<fftw_complex *>(const_cast<std::complex<double>*>(in.data())), reinterpret_cast<fftw_complex *>(out.data()));
+            return;
+        }
+
         std::vector<std::complex<double>> buffer_in(in.size());
         std::vector<std::complex<double>> buffer_out(in.size());
+        STRAINPP_COUNT("memory.bytes_allocated", 2 * in.size() * sizeof(std::complex<double>));
 
         Eigen::Map<Eigen::MatrixXcd>(&buffer_in[0], in.rows(), in.cols()) = in;
 
         if (plan) {
             fftw_execute_dft(*plan, reinterpret_cast<fftw_complex *>(&buffer_in[0]), reinterpret_cast<fftw_complex *>(&buffer_out[0]));
         } else {
-            plan = std::make_shared<fftw_plan>(fftw_plan_dft_2d(static_cast<int>(in.rows()), static_cast<int>(in.cols()), reinterpret_cast<fftw_complex*>(&buffer_in[0]), reinterpret_cast<fftw_complex*>(&buffer_out[0]), dir, FFTW_ESTIMATE));
+            plan = MakePlan(in.rows(), in.cols(), reinterpret_cast<fftw_complex*>(&buffer_in[0]), reinterpret_cast<fftw_complex*>(&buffer_out[0]), dir);
             fftw_execute(*plan);
         }
 
         out = Eigen::Map<Eigen::MatrixXcd>(&buffer_out[0], in.rows(), in.cols());
     }
 
-    static void doForwardFFT(std::shared_ptr<fftw_plan> plan, Eigen::MatrixXcd in, Eigen::MatrixXcd& out) {
+    inline void doForwardFFT(std::shared_ptr<fftw_plan> plan, const Eigen::MatrixXcd &in, Eigen::MatrixXcd& out) {
         doFFTPlan(plan, in, out, FFTW_FORWARD);
     }
 
-    static void doBackwardFFT(std::shared_ptr<fftw_plan> plan, Eigen::MatrixXcd in, Eigen::MatrixXcd& out) {
+    inline void doBackwardFFT(std::shared_ptr<fftw_plan> plan, const Eigen::MatrixXcd &in, Eigen::MatrixXcd& out) {
         doFFTPlan(plan, in, out, FFTW_BACKWARD);
     }
 
@@ -71,7 +170,7 @@ namespace UtilsFFT {
 
 namespace UtilsMaths {
 
-    static Eigen::MatrixXd MakeRotationMatrix(double angle)
+    inline Eigen::MatrixXd MakeRotationMatrix(double angle)
     {
         Eigen::Matrix<double, 2, 2> rotmat;
         angle *= PI/180;
@@ -84,38 +183,66 @@ namespace UtilsMaths {
         return rotmat;
     }
 
-    static double Distance(int x1, int y1, int x2, int y2)
+    inline double Distance(int x1, int y1, int x2, int y2)
     {
         return std::sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2));
     }
 
-    static double Distance(int x, int y)
+    inline double Distance(int x, int y)
     {
         return std::sqrt(x*x + y*y);
     }
 
-    template <typename T>
-    static std::shared_ptr<Eigen::MatrixXT<T>> HannWindow(const std::shared_ptr<Eigen::MatrixXT<T>> input)
+    // Least squares fit of a plane (c0 + c1*x + c2*y) to a block of a matrix, x is the column and y the row relative to
+    // the corner of the block. Only needs a few sums over the block so it's one pass without any big design matrices.
+    // Weighting is optional, each point is weighted by |amplitude|^2 starting from (ampRow0, ampCol0) of the amplitude
+    // matrix, so the weights are never made as a matrix of their own (their scale doesn't matter)
+    inline Eigen::Vector3d FitPlane(const Eigen::MatrixXd &data, int row0, int col0, int rows, int cols,
+                                    const Eigen::MatrixXcd *amplitude = nullptr, Eigen::Index ampRow0 = 0,
+                                    Eigen::Index ampCol0 = 0)
     {
-        std::shared_ptr<Eigen::MatrixXT<T>> output = std::make_shared<Eigen::MatrixXT<T>>(input->rows(), input->cols());
+        // coordinates are taken from the centre of the block to keep the sums well conditioned
+        double xm = 0.5 * (cols - 1);
+        double ym = 0.5 * (rows - 1);
+
+        double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0, sz = 0, sxz = 0, syz = 0;
+
+        #pragma omp parallel for reduction(+:sw,sx,sy,sxx,sxy,syy,sz,sxz,syz)
+        for (int j = 0; j < rows; ++j)
+        {
+            double y = j - ym;
+            for (int i = 0; i < cols; ++i)
+            {
+                double x = i - xm;
+                double w = amplitude ? std::norm((*amplitude)(j + ampRow0, i + ampCol0)) : 1.0;
+                double z = data(j + row0, i + col0);
+
+                sw += w;
+                sx += w * x;
+                sy += w * y;
+                sxx += w * x * x;
+                sxy += w * x * y;
+                syy += w * y * y;
+                sz += w * z;
+                sxz += w * x * z;
+                syz += w * y * z;
+            }
+        }
 
-        std::vector<double> hann_y(input->rows());
-        std::vector<double> hann_x(input->cols());
+        Eigen::Matrix3d normal;
+        normal << sw, sx, sy,
+                  sx, sxx, sxy,
+                  sy, sxy, syy;
 
-        #pragma omp parallel for
-        for(int i = 0; i < input->rows(); ++i)
-            hann_y[i] = 0.5 * (1 - std::cos( (2*PI*i) / (input->rows()-1) ));
+        Eigen::Vector3d rhs(sz, sxz, syz);
 
-        #pragma omp parallel for
-        for(int i = 0; i < input->cols(); ++i)
-            hann_x[i] = 0.5 * (1 - std::cos( (2*PI*i) / (input->cols()-1) ));
+        // a 3x3 so this is nothing, but it also copes with areas only one pixel wide (like the SVD used to)
+        Eigen::Vector3d c = normal.completeOrthogonalDecomposition().solve(rhs);
 
-        #pragma omp parallel for
-        for(int i = 0; i < input->rows(); ++i)
-            for(int j = 0; j < input->cols(); ++j)
-                output->coeffRef(i, j) = input->coeff(i, j) * hann_y[i] * hann_x[j];
+        // move the constant back to the corner of the block
+        c[0] -= c[1] * xm + c[2] * ym;
 
-        return output;
+        return c;
     }
 }
 
@@ -0,0 +1,163 @@
+#ifndef WINDOWS_H
+#define WINDOWS_H
+
+#ifndef EIGEN_DEFAULT_TO_ROW_MAJOR
+#define EIGEN_DEFAULT_TO_ROW_MAJOR
+#endif
+
+#ifndef EIGEN_INITIALIZE_MATRICES_BY_ZERO
+#define EIGEN_INITIALIZE_MATRICES_BY_ZERO
+#endif
+
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <stdexcept>
+
+#include <Eigen/Dense>
+#include "utils.h"
+
+// Apodisation windows for the image before it is FFT'd. All of these are separable, so only the 1D profiles are made
+// (and kept, as the same sizes come up again and again) and the image is multiplied by them as it is copied
+namespace UtilsWindow {
+
+    enum class WindowType { None, Hann, Tukey, Blackman, EdgeSmooth };
+
+    struct Window
+    {
+        WindowType type = WindowType::Hann;
+
+        // Tukey: fraction of the image that is tapered (0 is no window, 1 is Hann)
+        // EdgeSmooth: width of the taper at each edge in pixels
+        double parameter = 0.0;
+
+        Window() = default;
+
+        Window(WindowType t, double p = 0.0) : type(t), parameter(p) {}
+
+        bool operator==(const Window &other) const {return type == other.type && parameter == other.parameter;}
+        bool operator!=(const Window &other) const {return !(*this == other);}
+    };
+
+    inline std::vector<double> MakeProfile(const Window &window, int n)
+    {
+        std::vector<double> profile(n, 1.0);
+
+        if (n < 2)
+            return profile;
+
+        double last = n - 1;
+
+        switch (window.type)
+        {
+            case WindowType::None:
+                break;
+            case WindowType::Hann:
+                for (int i = 0; i < n; ++i)
+                    profile[i] = 0.5 * (1 - std::cos( (2*PI*i) / last ));
+                break;
+            case WindowType::Tukey:
+            {
+                double alpha = std::min(std::max(window.parameter, 0.0), 1.0);
+                double edge = 0.5 * alpha * last;
+                for (int i = 0; i < n; ++i)
+                {
+                    double d = std::min<double>(i, last - i);
+                    if (d < edge)
+                        profile[i] = 0.5 * (1 - std::cos(PI * d / edge));
+                }
+                break;
+            }
+            case WindowType::Blackman:
+                for (int i = 0; i < n; ++i)
+                    profile[i] = 0.42 - 0.5 * std::cos(2*PI*i / last) + 0.08 * std::cos(4*PI*i / last);
+                break;
+            case WindowType::EdgeSmooth:
+            {
+                double width = std::max(window.parameter, 0.0);
+                for (int i = 0; i < n; ++i)
+                {
+                    // the + 0.5 keeps the edge pixels from being completely zeroed
+                    double d = std::min<double>(i, last - i) + 0.5;
+                    if (d < width)
+                        profile[i] = 0.5 * (1 - std::cos(PI * d / width));
+                }
+                break;
+            }
+        }
+
+        return profile;
+    }
+
+    // profiles are only ever made once for each window and size
+    inline std::shared_ptr<const std::vector<double>> Profile(const Window &window, int n)
+    {
+        typedef std::tuple<int, double, int> Key;
+        static std::map<Key, std::shared_ptr<const std::vector<double>>> cache;
+        static std::mutex cacheMutex;
+
+        Key key(static_cast<int>(window.type), window.parameter, n);
+
+        std::lock_guard<std::mutex> lock(cacheMutex);
+
+        auto it = cache.find(key);
+        if (it != cache.end())
+            return it->second;
+
+        auto profile = std::make_shared<const std::vector<double>>(MakeProfile(window, n));
+        cache[key] = profile;
+        return profile;
+    }
+
+    // windowed copy of the input, with the FFT centring shift applied as well if shift is set (so the result can go
+    // straight into the FFT). 'output' can be the same as 'input'
+    template <typename T>
+    inline void Apply(const Window &window, const Eigen::MatrixXT<T> &input, Eigen::MatrixXT<T> &output, bool shift = false)
+    {
+        auto wy = Profile(window, static_cast<int>(input.rows()));
+        auto wx = Profile(window, static_cast<int>(input.cols()));
+
+        output.resize(input.rows(), input.cols());
+
+        #pragma omp parallel for
+        for (Eigen::Index j = 0; j < input.rows(); ++j)
+            for (Eigen::Index i = 0; i < input.cols(); ++i)
+            {
+                T v = input(j, i) * (*wy)[j] * (*wx)[i];
+                output(j, i) = shift ? UtilsFFT::CentreShift(v, i, j) : v;
+            }
+    }
+
+    template <typename T>
+    inline void ApplyInPlace(const Window &window, Eigen::MatrixXT<T> &image)
+    {
+        Apply(window, image, image);
+    }
+
+    // e.g. "hann", "blackman", "tukey:0.3", "edge:32"
+    inline Window Parse(const std::string &text)
+    {
+        std::string name = text.substr(0, text.find(':'));
+        bool hasParameter = text.find(':') != std::string::npos;
+        double parameter = hasParameter ? std::stod(text.substr(text.find(':') + 1)) : 0.0;
+
+        if (name == "none")
+            return Window(WindowType::None);
+        else if (name == "hann")
+            return Window(WindowType::Hann);
+        else if (name == "blackman")
+            return Window(WindowType::Blackman);
+        else if (name == "tukey")
+            return Window(WindowType::Tukey, hasParameter ? parameter : 0.5);
+        else if (name == "edge")
+            return Window(WindowType::EdgeSmooth, hasParameter ? parameter : 16.0);
+
+        throw std::runtime_error("Unknown window: " + text);
+    }
+}
+
+#endif // WINDOWS_H
@@ -0,0 +1,745 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cctype>
+#include <limits>
+
+#include <omp.h>
+
+#include "fftw3.h"
+#include "tiffio.h"
+
+#include "gpa.h"
+#include "tiledgpa.h"
+#include "outputs.h"
+#include "imageio.h"
+#include "pipeline.h"
+#include "stats.h"
+
+// Headless version of the GUI workflow, for running on machines without a display (e.g. cluster nodes).
+// All the coordinates are the same as shown in the GUI, i.e. relative to the centre of the image/FFT with y going up
+
+namespace {
+
+    typedef std::map<std::string, std::string> Options;
+
+    void printUsage()
+    {
+        std::cout << "Usage: strainpp-cli [options] <image.dm3|image.dm4|image.tif>\n"
+                     "\n"
+                     "  --config FILE          read options from FILE, one 'key = value' per line using the names\n"
+                     "                         below without the dashes (command line options take priority)\n"
+                     "  --output DIR           directory to write results to (default: current directory)\n"
+                     "  --g1 X,Y               first g-vector in FFT pixels\n"
+                     "  --g2 X,Y               second g-vector in FFT pixels\n"
+                     "  --g3 X,Y ...           any more g-vectors (numbered in order), the distortion is then a\n"
+                     "                         weighted least squares fit to all of them\n"
+                     "  --auto-g               find the g-vectors from the strongest Bragg spots (g1 and g2 are\n"
+                     "                         still used if given)\n"
+                     "  --sigma S              sigma of the Gaussian mask in FFT pixels\n"
+                     "  --mask-size R          mask size as given in the GUI (sigma = R / 6), estimated if neither this\n"
+                     "                         or sigma are given\n"
+                     "  --refine T,L,B,R       area to refine both g-vectors with (image pixels)\n"
+                     "  --refine1 T,L,B,R      area to refine the first g-vector with\n"
+                     "  --refine2 T,L,B,R      area to refine the second g-vector with (and so on for g3...)\n"
+                     "  --refine-repeats N     number of times to refine (default: 1)\n"
+                     "  --refine-weighted      weight the refinement by the Bragg amplitude\n"
+                     "  --refine-tol T         keep refining until the g-vectors move less than T FFT pixels\n"
+                     "                         (refine-repeats is then the maximum number of times, default: 20)\n"
+                     "  --roi T,L,B,R          only work out the results over this area (image pixels), the\n"
+                     "                         results are then this size. Refinement areas must be inside it\n"
+                     "  --angle A              rotation of the axes in degrees (default: 0)\n"
+                     "  --mode MODE            Distortion, Strain, Rotation or Dilitation (default: Distortion)\n"
+                     "  --hann                 apply a Hann window to the image\n"
+                     "  --window W[:P]         apply a window to the image, one of hann, blackman, tukey[:taper\n"
+                     "                         fraction] or edge[:width in pixels], this is also used for\n"
+                     "                         estimating the mask size and finding the g-vectors\n"
+                     "  --format FMT           tif or bin (default: tif)\n"
+                     "  --all                  also write the image, FFT and phase images (like 'Export all')\n"
+                     "  --slice N              only process slice N of a stack (default: all slices)\n"
+                     "  --tile N               process the image in N x N tiles, for images too big to do in one\n"
+                     "                         go. The mask size and g-vectors are still for the whole image (or\n"
+                     "                         estimated/found on the middle tile). Refinement can't be used and\n"
+                     "                         --all only adds the normalised phases. Tiffs are read and the\n"
+                     "                         results written a band of tiles at a time, so the whole image is\n"
+                     "                         never in memory\n"
+                     "  --tile-overlap P       pixels each tile overlaps its neighbours by on each side (default:\n"
+                     "                         enough for the mask size, about 0.5 / (sigma / image width))\n"
+                     "  --stats                print how long each part took (and other counts) at the end\n"
+                     "  --stats-json FILE      write the same to FILE as JSON\n"
+                     "  --trace FILE           write a timeline of the same parts to FILE, with the thread and slice\n"
+                     "                         each ran on (open it in chrome://tracing or ui.perfetto.dev)\n"
+                     "  --trace-events N       most events kept for --trace, the oldest go first (default: 1048576)\n"
+                     "  --help                 show this message\n";
+    }
+
+    std::string trim(const std::string &in)
+    {
+        size_t first = in.find_first_not_of(" \t\r\n");
+        if (first == std::string::npos)
+            return "";
+        size_t last = in.find_last_not_of(" \t\r\n");
+        return in.substr(first, last - first + 1);
+    }
+
+    // these are options that don't take a value
+    bool isFlag(const std::string &key)
+    {
+        return key == "hann" || key == "all" || key == "help" || key == "refine-weighted" || key == "auto-g" ||
+               key == "stats";
+    }
+
+    void readConfig(const std::string &path, Options &opts)
+    {
+        std::ifstream file(path);
+        if (!file)
+            throw std::runtime_error("Could not open config file: " + path);
+
+        std::string line;
+        while (std::getline(file, line))
+        {
+            line = trim(line.substr(0, line.find('#')));
+            if (line.empty())
+                continue;
+
+            size_t eq = line.find('=');
+            std::string key = trim(line.substr(0, eq));
+            std::string value = eq == std::string::npos ? "true" : trim(line.substr(eq + 1));
+
+            // don't overwrite anything from the command line
+            if (opts.find(key) == opts.end())
+                opts[key] = value;
+        }
+    }
+
+    Options parseArguments(int argc, char *argv[])
+    {
+        Options opts;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+
+            if (arg == "-h")
+                arg = "--help";
+
+            if (arg.compare(0, 2, "--") != 0)
+            {
+                if (opts.count("input"))
+                    throw std::runtime_error("Only one input file can be given");
+                opts["input"] = arg;
+                continue;
+            }
+
+            std::string key = arg.substr(2);
+            if (isFlag(key))
+                opts[key] = "true";
+            else if (i + 1 < argc)
+                opts[key] = argv[++i];
+            else
+                throw std::runtime_error("Missing value for " + arg);
+        }
+
+        if (opts.count("config"))
+            readConfig(opts["config"], opts);
+
+        return opts;
+    }
+
+    std::vector<double> parseList(const std::string &key, const std::string &value, size_t n)
+    {
+        std::vector<double> out;
+        std::stringstream ss(value);
+        std::string item;
+
+        while (std::getline(ss, item, ','))
+            out.push_back(std::stod(item));
+
+        if (out.size() != n)
+            throw std::runtime_error("Expected " + std::to_string(n) + " comma separated values for " + key);
+
+        return out;
+    }
+
+    bool flagSet(const Options &opts, const std::string &key)
+    {
+        auto it = opts.find(key);
+        return it != opts.end() && (it->second == "true" || it->second == "1" || it->second == "yes");
+    }
+
+    std::string getOption(const Options &opts, const std::string &key, const std::string &fallback)
+    {
+        auto it = opts.find(key);
+        return it == opts.end() ? fallback : it->second;
+    }
+
+    std::string extension(const std::string &path)
+    {
+        size_t dot = path.find_last_of('.');
+        if (dot == std::string::npos)
+            return "";
+        std::string ext = path.substr(dot + 1);
+        for (char &c : ext)
+            c = static_cast<char>(std::tolower(c));
+        return ext;
+    }
+
+    // where the frames come from, tiffs are read a frame at a time, DM files have to be read in one go
+    class FrameSource
+    {
+    public:
+        explicit FrameSource(const std::string &path) : _Tif(nullptr), _ReaderFrame(0), _CachePixels(1 << 24)
+        {
+            std::string ext = extension(path);
+
+            if (ext == "dm3" || ext == "dm4")
+            {
+                DMRead::DMReader dmFile(path);
+                _Frames = UtilsIO::ReadDM(dmFile);
+                _Count = _Frames.size();
+            }
+            else if (ext == "tif" || ext == "tiff")
+            {
+                TIFFSetWarningHandler(nullptr);
+                _Tif = TIFFOpen(path.c_str(), "r");
+                if (_Tif == nullptr)
+                    throw std::runtime_error("Error opening TIFF");
+                _Count = TIFFNumberOfDirectories(_Tif);
+            }
+            else
+                throw std::runtime_error("Unsupported file type: " + path);
+        }
+
+        ~FrameSource()
+        {
+            if (_Tif != nullptr)
+                TIFFClose(_Tif);
+        }
+
+        size_t count() const {return _Count;}
+
+        // not thread safe, only to be used from one thread at a time
+        Eigen::MatrixXcd getFrame(size_t i)
+        {
+            if (_Tif == nullptr)
+                return _Frames[i];
+
+            _Reader.reset();
+            setDirectory(i);
+            return UtilsIO::ReadTiffFrame(_Tif);
+        }
+
+        // rows and columns of frame i, without reading all of it
+        std::pair<std::int64_t, std::int64_t> getSize(size_t i)
+        {
+            if (_Tif == nullptr)
+                return std::make_pair(_Frames[i].rows(), _Frames[i].cols());
+
+            auto &reader = areaReader(i);
+            return std::make_pair(reader.rows(), reader.cols());
+        }
+
+        // part of frame i starting at (row0, col0), the size of 'out'. Tiffs only read the strips (or tiles) that are
+        // needed and keep up to setAreaCache pixels of them for the next area (see UtilsIO::TiffAreaReader)
+        void getArea(size_t i, std::int64_t row0, std::int64_t col0, Eigen::MatrixXcd &out)
+        {
+            if (_Tif == nullptr)
+                out = _Frames[i].block(row0, col0, out.rows(), out.cols());
+            else
+                areaReader(i).read(row0, col0, out);
+        }
+
+        void setAreaCache(std::int64_t pixels)
+        {
+            _CachePixels = pixels;
+            _Reader.reset();
+        }
+
+    private:
+        void setDirectory(size_t i)
+        {
+            // tdir_t is only 16 bits before libtiff 4.5, so don't let the index wrap round to an earlier slice
+            if (i > std::numeric_limits<tdir_t>::max())
+                throw std::runtime_error("Slice " + std::to_string(i) + " is past the last one libtiff can reach");
+
+            if (!TIFFSetDirectory(_Tif, static_cast<tdir_t>(i)))
+                throw std::runtime_error("Could not read slice " + std::to_string(i));
+        }
+
+        UtilsIO::TiffAreaReader &areaReader(size_t i)
+        {
+            if (!_Reader || _ReaderFrame != i)
+            {
+                _Reader.reset();
+                setDirectory(i);
+                _Reader = std::make_unique<UtilsIO::TiffAreaReader>(_Tif, _CachePixels);
+                _ReaderFrame = i;
+            }
+
+            return *_Reader;
+        }
+
+        TIFF* _Tif;
+
+        size_t _Count;
+
+        std::vector<Eigen::MatrixXcd> _Frames;
+
+        std::unique_ptr<UtilsIO::TiffAreaReader> _Reader;
+        size_t _ReaderFrame;
+        std::int64_t _CachePixels;
+    };
+
+    // converts an area from the displayed coordinates to the matrix indices, the same as the GUI does
+    void toMatrixArea(GPA &engine, const std::vector<double> &area, int &t, int &l, int &b, int &r,
+                      const std::string &name)
+    {
+        auto size = engine.getSize();
+        int rowmid = size.y / 2;
+        int colmid = size.x / 2;
+
+        t = static_cast<int>(std::max(area[0], area[2])) + rowmid;
+        b = static_cast<int>(std::min(area[0], area[2])) + rowmid;
+        l = static_cast<int>(std::min(area[1], area[3])) + colmid;
+        r = static_cast<int>(std::max(area[1], area[3])) + colmid;
+
+        if (b < 0 || l < 0 || t > size.y || r > size.x || t - b < 2 || r - l < 2)
+            throw std::runtime_error(name + " is outside the image");
+    }
+
+    // a tolerance of 0 or less refines a fixed number of times
+    void refine(GPA &engine, int phase, const std::vector<double> &area, int repeats, bool weighted, double tolerance)
+    {
+        int t, l, b, r;
+        toMatrixArea(engine, area, t, l, b, r, "Refinement area");
+
+        if (tolerance > 0)
+        {
+            auto report = engine.getPhase(phase)->refineUntilConverged(t, l, b, r, tolerance, repeats, weighted);
+            std::cout << "Refinement of g" << phase+1 << (report.converged ? " converged" : " did not converge")
+                      << " after " << report.iterations << " iterations (last change " << report.change << " px, "
+                      << report.seconds << " s)" << std::endl;
+        }
+        else
+        {
+            for (int i = 0; i < repeats; ++i)
+            {
+                engine.getPhase(phase)->getWrappedPhase();
+                engine.getPhase(phase)->refinePhase(t, l, b, r, weighted);
+            }
+            engine.getPhase(phase)->getWrappedPhase();
+        }
+
+        auto g = engine.getPhase(phase)->getGVectorPixels();
+        std::cout << "Refined g" << phase+1 << ": " << g.x << ", " << g.y << std::endl;
+    }
+
+    // Each slice is split into tiles which are spread over the threads. The g-vectors and sigma are converted to cycles
+    // per pixel so they are the same for all the tiles
+    int runTiled(const Options &opts, FrameSource &source, size_t first, size_t count, const std::string &mode,
+                 double angle, int choice, const std::string &outDir)
+    {
+        for (const auto &o : opts)
+            if (o.first == "refine" || (o.first.compare(0, 6, "refine") == 0 && std::isdigit(o.first.back())))
+                throw std::runtime_error("Refinement can't be used with --tile");
+
+        if (opts.count("roi"))
+            throw std::runtime_error("--roi can't be used with --tile");
+
+        int tileSize = std::stoi(opts.at("tile"));
+        int nw = static_cast<int>(std::floor(std::log10(source.count()) + 1));
+
+        std::vector<Coord2D<double>> gs;
+        Coord2D<double> sigma(0, 0);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            UtilsTrace::FrameScope slice(first + i);
+
+            std::int64_t rows, cols;
+            std::tie(rows, cols) = source.getSize(first + i);
+
+            Coord2D<std::int64_t> tileSize2D(std::min<std::int64_t>(tileSize, cols),
+                                             std::min<std::int64_t>(tileSize, rows));
+
+            // enough for the band of tiles being done and the next, which the workers get to before the first is done
+            source.setAreaCache(2 * (tileSize2D.y + 1) * cols);
+
+            // worked out from the first slice, like the untiled version
+            if (i == 0)
+            {
+                // anything estimated or found is done on the middle tile, only made if it is needed
+                std::unique_ptr<GPA> middle;
+                auto getMiddle = [&]() -> GPA&
+                {
+                    if (!middle)
+                    {
+                        Eigen::MatrixXcd tile(tileSize2D.y, tileSize2D.x);
+                        source.getArea(first + i, (rows - tileSize2D.y) / 2, (cols - tileSize2D.x) / 2, tile);
+                        middle = std::make_unique<GPA>(tile);
+                        if (opts.count("window"))
+                            middle->setWindow(UtilsWindow::Parse(opts.at("window")));
+                    }
+                    return *middle;
+                };
+
+                // sigma is in the FFT pixels of the whole slice (as untiled), which are a different fraction of the
+                // rows and the columns if it isn't square
+                double sigmaPx;
+                if (opts.count("sigma"))
+                    sigmaPx = std::stod(opts.at("sigma"));
+                else if (opts.count("mask-size"))
+                    sigmaPx = std::stod(opts.at("mask-size")) / 6;
+                else
+                {
+                    int minGrad = getMiddle().getGVectors();
+                    sigmaPx = minGrad / 6.0 * cols / tileSize2D.x;
+                    std::cout << "Estimated mask size: " << minGrad * cols / tileSize2D.x << std::endl;
+                }
+                sigma = Coord2D<double>(sigmaPx / cols, sigmaPx / rows);
+
+                gs.assign(2, Coord2D<double>(0, 0));
+                if (flagSet(opts, "auto-g"))
+                {
+                    Coord2D<double> g1(0, 0), g2(0, 0);
+                    getMiddle().findGVectors(3 * sigma.x * tileSize2D.x, g1, g2);
+                    gs[0] = Coord2D<double>(g1.x / tileSize2D.x, g1.y / tileSize2D.y);
+                    gs[1] = Coord2D<double>(g2.x / tileSize2D.x, g2.y / tileSize2D.y);
+                    std::cout << "Found g1: " << gs[0].x * cols << ", " << gs[0].y * rows << "  g2: " << gs[1].x * cols
+                              << ", " << gs[1].y * rows << std::endl;
+                }
+
+                for (int p = 0; opts.count("g" + std::to_string(p+1)); ++p)
+                {
+                    std::string key = "g" + std::to_string(p+1);
+                    auto g = parseList(key, opts.at(key), 2);
+                    if (static_cast<size_t>(p) >= gs.size())
+                        gs.emplace_back(0, 0);
+                    gs[p] = Coord2D<double>(g[0] / cols, g[1] / rows);
+                }
+            }
+
+            // the default overlap is enough to keep the tile edges out of the results (see SuggestedOverlap)
+            int overlap = opts.count("tile-overlap") ? std::stoi(opts.at("tile-overlap"))
+                                                     : TiledGPA::SuggestedOverlap(sigma);
+
+            TiledGPA tiled(rows, cols, tileSize, overlap);
+            tiled.setGVectors(gs, sigma);
+
+            std::string prefix;
+            if (source.count() > 1)
+            {
+                prefix = std::to_string(first + i);
+                prefix = std::string(nw - prefix.size(), '0') + prefix + " ";
+            }
+
+            // The tiles in a band (a row of tiles) are put together as they come in, then the band is written out as
+            // soon as all of it is there. The workers go through the tiles in order so only a few bands are ever held
+            std::vector<std::unique_ptr<UtilsIO::RowWriter>> writers;
+            std::map<std::int64_t, std::pair<std::int64_t, std::vector<Eigen::MatrixXd>>> bands;
+
+            auto sink = [&](const TiledGPA::Region &area, const StrainOutputs::NamedImages &results)
+            {
+                STRAINPP_TIME("stack.write");
+
+                if (writers.empty())
+                    for (auto &r : results)
+                        writers.push_back(std::make_unique<UtilsIO::RowWriter>(outDir + "/" + prefix + r.first,
+                                                                               rows, cols, choice));
+
+                auto &band = bands[area.row0];
+                if (band.second.empty())
+                    band.second.assign(results.size(), Eigen::MatrixXd(area.rows, cols));
+
+                for (size_t k = 0; k < results.size(); ++k)
+                    band.second[k].block(0, area.col0, area.rows, area.cols) = results[k].second;
+
+                band.first += area.cols;
+                if (band.first < cols)
+                    return;
+
+                for (size_t k = 0; k < results.size(); ++k)
+                    writers[k]->write(area.row0, band.second[k]);
+
+                bands.erase(area.row0);
+            };
+
+            auto tileSource = [&](const TiledGPA::Region &area, Eigen::MatrixXcd &tile)
+            {
+                STRAINPP_TIME("stack.read");
+                source.getArea(first + i, area.row0, area.col0, tile);
+            };
+
+            tiled.run(tileSource, sink, angle, mode, flagSet(opts, "all"));
+
+            if (!bands.empty())
+                throw std::logic_error("Not all of the image was written");
+
+            for (auto &w : writers)
+                w->close();
+
+            std::cout << "Written slice " << first + i << " (" << tiled.getTiles().size() << " tiles)" << std::endl;
+        }
+
+        return 0;
+    }
+
+    int run(const Options &opts)
+    {
+        if (!opts.count("input"))
+            throw std::runtime_error("No input file given");
+
+        bool autoG = flagSet(opts, "auto-g");
+        if (!autoG && (!opts.count("g1") || !opts.count("g2")))
+            throw std::runtime_error("Both g-vectors (--g1 and --g2) must be given, or use --auto-g");
+
+        std::string mode = getOption(opts, "mode", "Distortion");
+        if (mode != "Distortion" && mode != "Strain" && mode != "Rotation" && mode != "Dilitation")
+            throw std::runtime_error("Unknown mode: " + mode);
+
+        std::string format = getOption(opts, "format", "tif");
+        int choice;
+        if (format == "tif")
+            choice = 1;
+        else if (format == "bin")
+            choice = 2;
+        else
+            throw std::runtime_error("Unknown format: " + format);
+
+        double angle = std::stod(getOption(opts, "angle", "0"));
+        bool all = flagSet(opts, "all");
+        std::string outDir = getOption(opts, "output", ".");
+        double tolerance = std::stod(getOption(opts, "refine-tol", "0"));
+        int repeats = std::stoi(getOption(opts, "refine-repeats", tolerance > 0 ? "20" : "1"));
+
+        FrameSource source(opts.at("input"));
+
+        size_t first = 0;
+        size_t count = source.count();
+        if (opts.count("slice"))
+        {
+            first = std::stoul(opts.at("slice"));
+            if (first >= count)
+                throw std::runtime_error("Slice " + std::to_string(first) + " is not in the stack");
+            count = 1;
+        }
+
+        if (opts.count("tile"))
+            return runTiled(opts, source, first, count, mode, angle, choice, outDir);
+
+        // the g-vectors are found (and refined) on the first slice to be processed
+        GPA engine(source.getFrame(first));
+        engine.setDoHann(flagSet(opts, "hann") || opts.count("window"));
+        if (opts.count("window"))
+            engine.setWindow(UtilsWindow::Parse(opts.at("window")));
+
+        double sigma;
+        if (opts.count("sigma"))
+            sigma = std::stod(opts.at("sigma"));
+        else if (opts.count("mask-size"))
+            sigma = std::stod(opts.at("mask-size")) / 6;
+        else
+        {
+            int minGrad = engine.getGVectors();
+            sigma = minGrad / 6.0;
+            std::cout << "Estimated mask size: " << minGrad << std::endl;
+        }
+
+        // the FFT (and so the mask size and finding the g-vectors) is still of the whole image
+        if (opts.count("roi"))
+        {
+            int t, l, b, r;
+            toMatrixArea(engine, parseList("roi", opts.at("roi"), 4), t, l, b, r, "Region of interest");
+
+            ImageRegion region;
+            region.row0 = b;
+            region.col0 = l;
+            region.rows = t - b;
+            region.cols = r - l;
+            engine.setRegion(region);
+        }
+
+        std::vector<std::vector<double>> gs(2);
+        if (autoG)
+        {
+            // the mask radius is 3 sigma, anything closer to the centre is just the tail of the central spot
+            Coord2D<double> g1(0, 0), g2(0, 0);
+            engine.findGVectors(3 * sigma, g1, g2);
+            gs[0] = {g1.x, g1.y};
+            gs[1] = {g2.x, g2.y};
+            std::cout << "Found g1: " << g1.x << ", " << g1.y << "  g2: " << g2.x << ", " << g2.y << std::endl;
+        }
+
+        for (int p = 0; p < 2; ++p)
+        {
+            std::string key = "g" + std::to_string(p+1);
+            if (opts.count(key))
+                gs[p] = parseList(key, opts.at(key), 2);
+        }
+
+        // extra g-vectors carry on from g3 until one is missing
+        for (int p = 2; opts.count("g" + std::to_string(p+1)); ++p)
+        {
+            std::string key = "g" + std::to_string(p+1);
+            gs.push_back(parseList(key, opts.at(key), 2));
+        }
+
+        for (int p = 0; p < static_cast<int>(gs.size()); ++p)
+            engine.calculatePhase(p, gs[p][0], gs[p][1], sigma);
+
+        engine.computePhases();
+
+        for (int p = 0; p < static_cast<int>(gs.size()); ++p)
+        {
+            std::string key = "refine" + std::to_string(p+1);
+            if (!opts.count(key))
+                key = "refine";
+
+            if (opts.count(key))
+                refine(engine, p, parseList(key, opts.at(key), 4), repeats, flagSet(opts, "refine-weighted"),
+                       tolerance);
+        }
+
+        int nw = static_cast<int>(std::floor(std::log10(source.count()) + 1));
+
+        // each stage is on its own thread, so they each say which slice they are on for the timeline
+        auto read = [&](size_t i, Eigen::MatrixXcd &frame)
+        {
+            UtilsTrace::FrameScope slice(first + i);
+            STRAINPP_TIME("stack.read");
+            frame = source.getFrame(first + i);
+            return true;
+        };
+
+        auto compute = [&](size_t i, Eigen::MatrixXcd &frame, int /*worker*/)
+        {
+            UtilsTrace::FrameScope slice(first + i);
+            STRAINPP_TIME("stack.compute");
+            engine.updateImage(frame);
+            engine.calculateDistortion(angle, mode);
+            return StrainOutputs::Collect(engine, mode, all, angle);
+        };
+
+        auto write = [&](size_t i, StrainOutputs::NamedImages &out)
+        {
+            UtilsTrace::FrameScope slice(first + i);
+            STRAINPP_TIME("stack.write");
+
+            std::string prefix;
+            if (source.count() > 1)
+            {
+                prefix = std::to_string(first + i);
+                prefix = std::string(nw - prefix.size(), '0') + prefix + " ";
+            }
+
+            for (auto &o : out)
+                UtilsIO::WriteSelector(outDir + "/" + prefix + o.first, o.second, choice);
+
+            std::cout << "Written slice " << first + i << std::endl;
+        };
+
+        // only one worker as there is only one engine, the reading and writing still overlap with it
+        UtilsPipeline::StackPipeline<Eigen::MatrixXcd, StrainOutputs::NamedImages> pipeline(2, 1);
+        pipeline.run(count, read, compute, write);
+
+        return 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    try
+    {
+        opts = parseArguments(argc, argv);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    if (flagSet(opts, "help") || argc < 2)
+    {
+        printUsage();
+        return 0;
+    }
+
+    bool stats = flagSet(opts, "stats") || opts.count("stats-json");
+    if (stats)
+    {
+#ifndef STRAINPP_STATS
+        std::cerr << "Warning: built without STRAINPP_STATS, there will be no stats" << std::endl;
+#endif
+        UtilsStats::SetEnabled(true);
+    }
+
+    if (opts.count("trace"))
+    {
+#ifndef STRAINPP_STATS
+        std::cerr << "Warning: built without STRAINPP_STATS, the trace will be empty" << std::endl;
+#endif
+        try
+        {
+            UtilsTrace::Start(opts.count("trace-events") ? std::stoull(opts.at("trace-events")) : 1 << 20);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error: bad --trace-events: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    fftw_init_threads();
+    fftw_plan_with_nthreads(omp_get_max_threads());
+
+    int result;
+    try
+    {
+        result = run(opts);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        result = 1;
+    }
+
+    fftw_cleanup_threads();
+
+    // these are still written if it failed, it might be why
+    if (flagSet(opts, "stats"))
+        std::cout << "\n" << UtilsStats::Summary();
+
+    if (opts.count("stats-json"))
+    {
+        std::ofstream file(opts.at("stats-json"));
+        file << UtilsStats::Json();
+        if (!file)
+        {
+            std::cerr << "Error: could not write " << opts.at("stats-json") << std::endl;
+            result = 1;
+        }
+    }
+
+    if (opts.count("trace"))
+    {
+        try
+        {
+            UtilsTrace::Write(opts.at("trace"));
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            result = 1;
+        }
+    }
+
+    return result;
+}
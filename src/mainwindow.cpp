@@ -4,6 +4,10 @@
 #include <QtSvg/QSvgRenderer>
 #include "dmreader.h"
 #include "utils.h"
+#include "imageio.h"
+#include "pipeline.h"
+#include "outputs.h"
+#include "stats.h"
 #include "versiondialog.h"
 
 MainWindow::MainWindow(QWidget *parent) :
@@ -46,6 +50,17 @@ MainWindow::MainWindow(QWidget *parent) :
 
     statusBar()->addWidget(statusLabel);
 
+    // only shown while a job is running
+    jobProgressBar = new QProgressBar();
+    jobProgressBar->setMaximumWidth(200);
+    jobProgressBar->setVisible(false);
+    statusBar()->addPermanentWidget(jobProgressBar);
+
+    cancelButton = new QPushButton("Cancel");
+    cancelButton->setVisible(false);
+    statusBar()->addPermanentWidget(cancelButton);
+    connect(cancelButton, SIGNAL(clicked()), this, SLOT(cancelJobs()));
+
     on_angleSpin_editingFinished(); // this is just to update the axes image...
 
     // connect al the slots to update the strain images
@@ -67,6 +82,7 @@ MainWindow::MainWindow(QWidget *parent) :
 
 MainWindow::~MainWindow()
 {
+    abandonJobs();
     DisconnectAll();
     fftw_cleanup_threads();
     delete ui;
@@ -77,6 +93,170 @@ void MainWindow::updateStatusBar(QString message)
     statusLabel->setText(message);
 }
 
+void MainWindow::startJob(const QString &name, UtilsJobs::Worker::Function work, std::function<void()> done,
+                          std::function<void()> stopped)
+{
+    PendingJob job;
+    job.name = name;
+    job.work = std::move(work);
+    job.done = std::move(done);
+    job.stopped = std::move(stopped);
+
+    pendingJobs.push_back(std::move(job));
+
+    runNextJob();
+}
+
+void MainWindow::runNextJob()
+{
+    if (jobRunning || pendingJobs.empty())
+        return;
+
+    currentJobInfo = std::move(pendingJobs.front());
+    pendingJobs.pop_front();
+
+    int id = ++currentJobId;
+    jobRunning = true;
+
+    updateStatusBar(currentJobInfo.name + "...");
+    jobProgressBar->setRange(0, 0);
+    jobProgressBar->setVisible(true);
+    cancelButton->setVisible(true);
+
+    auto work = currentJobInfo.work;
+
+    // nothing is thrown out of here, it all goes back to the GUI thread
+    auto run = [this, id, work](UtilsJobs::Progress &progress)
+    {
+        QString error;
+        bool cancelled = false;
+
+        try
+        {
+            // this is still called if it was cancelled before it started, so that jobFinished always gets posted
+            progress.checkCancelled();
+            if (work)
+                work(progress);
+            progress.checkCancelled();
+        }
+        catch (const UtilsJobs::Cancelled&)
+        {
+            cancelled = true;
+        }
+        catch (const std::exception& e)
+        {
+            error = QString::fromStdString(e.what());
+        }
+
+        QMetaObject::invokeMethod(this, "jobFinished", Qt::QueuedConnection, Q_ARG(int, id), Q_ARG(QString, error),
+                                  Q_ARG(bool, cancelled));
+    };
+
+    auto report = [this, id](const std::string &stage, size_t done, size_t total)
+    {
+        QMetaObject::invokeMethod(this, "jobProgress", Qt::QueuedConnection, Q_ARG(int, id),
+                                  Q_ARG(QString, QString::fromStdString(stage)), Q_ARG(int, static_cast<int>(done)),
+                                  Q_ARG(int, static_cast<int>(total)));
+    };
+
+    currentJob = worker.submit(run, report);
+}
+
+void MainWindow::jobProgress(int id, QString stage, int done, int total)
+{
+    if (!jobRunning || id != currentJobId)
+        return;
+
+    if (!stage.isEmpty())
+        updateStatusBar(stage + "...");
+
+    // unknown totals just show that something is happening
+    jobProgressBar->setRange(0, total);
+    jobProgressBar->setValue(done);
+}
+
+void MainWindow::jobFinished(int id, QString error, bool cancelled)
+{
+    if (!jobRunning || id != currentJobId)
+        return;
+
+    // the job has finished by the time this is sent, this is just tidying up
+    if (currentJob.result.valid())
+        currentJob.result.wait();
+
+    jobProgressBar->setVisible(false);
+    cancelButton->setVisible(false);
+
+    PendingJob finished = std::move(currentJobInfo);
+
+    // still counts as running until these are done (they might use the engines, or have dialogs that let other
+    // things be started)
+    if (!error.isEmpty())
+    {
+        updateStatusBar("--");
+        QMessageBox::critical(nullptr, "Error", error);
+        if (finished.stopped)
+            finished.stopped();
+    }
+    else if (cancelled)
+    {
+        updateStatusBar("Cancelled");
+        if (finished.stopped)
+            finished.stopped();
+    }
+    else
+    {
+        updateStatusBar("--");
+        if (finished.done)
+            finished.done();
+    }
+
+    // where the time went (including showing the results) if the stats are turned on with the STRAINPP_STATS
+    // environment variable
+    if (UtilsStats::Enabled())
+    {
+        std::string times = UtilsStats::ShortSummary();
+        if (!times.empty())
+            updateStatusBar(statusLabel->text() + "  [" + QString::fromStdString(times) + "]");
+        UtilsStats::Reset();
+    }
+
+    // abandonJobs might have been called in the meantime
+    if (id == currentJobId)
+        jobRunning = false;
+
+    runNextJob();
+}
+
+void MainWindow::cancelJobs()
+{
+    pendingJobs.clear();
+
+    if (jobRunning && currentJob.progress)
+    {
+        currentJob.progress->cancel();
+        updateStatusBar("Cancelling...");
+    }
+}
+
+void MainWindow::abandonJobs()
+{
+    pendingJobs.clear();
+
+    if (currentJob.progress)
+        currentJob.progress->cancel();
+
+    if (currentJob.result.valid())
+        currentJob.result.wait();
+
+    // anything still on its way from the old job is ignored
+    ++currentJobId;
+    jobRunning = false;
+
+    jobProgressBar->setVisible(false);
+    cancelButton->setVisible(false);
+}
+
 void MainWindow::on_actionOpen_triggered()
 {
     if (haveStrains)
@@ -95,6 +275,8 @@ void MainWindow::on_actionOpen_triggered()
     if (fileName.isNull())
         return;
 
+    abandonJobs();
+
     DisconnectAll();
     ClearImages();
 
@@ -163,50 +345,14 @@ bool MainWindow::openDMProper(std::shared_ptr<DMRead::DMReader> dmFile)
     // something to print tags?
     // dmFile->printTags();
 
-    // get image data first as this catches some errors in a more sensible way
-    // (e.g. binary images have no dimensions somehow....
-    std::vector<double> image;
+    // set original image so we may reset to it later
     try {
-        image = dmFile->getImage();
+        original_image = UtilsIO::ReadDM(*dmFile);
     } catch (const std::exception& e) {
         QMessageBox::information(this, tr("File open"), tr(e.what()), QMessageBox::Ok);
         return false;
     }
 
-    // get important image info
-    int nx, ny, nz;
-    try {
-        nx = dmFile->getX();
-        ny = dmFile->getY();
-        nz = dmFile->getZ();
-    } catch (const std::exception& e) {
-        QMessageBox::information(this, tr("File open"), tr("Image dimensions not found."), QMessageBox::Ok);
-        return false;
-    }
-
-    if (nx < 3 || ny < 3)
-    {
-        QMessageBox::information(this, tr("File open"), tr("Image too small."), QMessageBox::Ok);
-        return false;
-    }
-
-    dmFile->close();
-
-    // image is complex for FFTing later
-    std::vector<Eigen::MatrixXcd> complexImage(nz, Eigen::MatrixXcd(ny, nx));
-
-    #pragma omp parallel for
-    for (int k = 0; k < nz; ++k ) {
-        for (int i = 0; i < nx * ny; ++i)
-            complexImage[k](i) = image[k * (nx * ny) + i];
-
-        complexImage[k] = complexImage[k].colwise().reverse().eval();
-    }
-
-    image.clear();
-
-    // set original image so we may reset to it later
-    original_image = complexImage;
     return true;
 }
 
@@ -230,60 +376,12 @@ bool MainWindow::openTIFF(std::string filename)
 
 bool MainWindow::openTIFFProper(TIFF* tif)
 {
-    if (tif == nullptr)
-    {
-        QMessageBox::information(this, tr("File open"), tr("Error opening TIFF"), QMessageBox::Ok);
-        return false;
-    }
-
-    // this is defaulting to 1 according to: https://www.awaresystems.be/imaging/tiff/tifftags/samplesperpixel.html
-    uint32 samples = 1;
-    TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
-
-    if (samples != 1)
-    {
-        QMessageBox::information(this, tr("File open"), tr("TIFF must be greyscale"), QMessageBox::Ok);
-        return false;
-    }
-
-    uint16 format = SAMPLEFORMAT_UINT;
-    TIFFGetField(tif, TIFFTAG_SAMPLEFORMAT, &format);
-
-    uint16 bitsper = 1;
-    TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &bitsper);
-
-    if (format == SAMPLEFORMAT_UINT)
-    {
-        if (bitsper == 8)
-            readTiffData<uint8>(tif);
-        else if (bitsper == 16)
-            readTiffData<uint16>(tif);
-        else if(bitsper == 32)
-            readTiffData<uint32>(tif);
-        else if (bitsper == 64)
-            readTiffData<uint64>(tif);
-    }
-    else if (format == SAMPLEFORMAT_INT)
-    {
-        if (bitsper == 8)
-            readTiffData<int8>(tif);
-        else if (bitsper == 16)
-            readTiffData<int16>(tif);
-        else if(bitsper == 32)
-            readTiffData<int32>(tif);
-        else if (bitsper == 64)
-            readTiffData<int64>(tif);
-    }
-    else if (format == SAMPLEFORMAT_IEEEFP)
-    {
-        if(bitsper == 32)
-            readTiffData<float>(tif);
-        else if (bitsper == 64)
-            readTiffData<double>(tif);
-    }
-    else
-    {
-        QMessageBox::information(this, tr("File open"), tr("Unsupported TIFF format"), QMessageBox::Ok);
+    try {
+        original_image = UtilsIO::ReadTiff(tif);
+    } catch (const std::exception& e) {
+        QMessageBox::information(this, tr("File open"), tr(e.what()), QMessageBox::Ok);
+        if (tif != nullptr)
+            TIFFClose(tif);
         return false;
     }
 
@@ -294,9 +392,22 @@ bool MainWindow::openTIFFProper(TIFF* tif)
 
 void MainWindow::showNewImageAndFFT(std::vector<Eigen::MatrixXcd> &image, unsigned int slice)
 {
-    GPAstrain = std::make_unique<GPA>(GPA(image[slice]));
+    previewGPA.reset();
+
+    // the old engine is kept until the new one is ready
+    auto engine = std::make_shared<std::unique_ptr<GPA>>();
+
+    startJob("Calculating FFT", [&image, slice, engine](UtilsJobs::Progress &)
+    {
+        *engine = std::make_unique<GPA>(image[slice]);
 
-    showImageAndFFT();
+        // this is kept, so showing it later is quick
+        (*engine)->getFFTPowerSpectrum();
+    }, [this, engine]()
+    {
+        GPAstrain = std::move(*engine);
+        showImageAndFFT();
+    });
 }
 
 void MainWindow::showImageAndFFT(bool rePlot)
@@ -318,7 +429,7 @@ void MainWindow::showImageAndFFT(bool rePlot)
     // show reciprocal space image
     try
     {
-        ui->fftPlot->SetImage(*(GPAstrain->getFFT()), ShowComplex::PowerSpectrum, rePlot);
+        ui->fftPlot->SetImage(GPAstrain->getFFTPowerSpectrum(), rePlot);
     }
     catch (const std::exception& e)
     {
@@ -329,6 +440,67 @@ void MainWindow::showImageAndFFT(bool rePlot)
     haveImage = true;
     ui->actionHann->setEnabled(true);
     ui->actionGPA->setEnabled(true);
+
+    // not for each slice of a stack export, only when the image is actually being looked at
+    if (rePlot)
+        updatePreview();
+}
+
+void MainWindow::updatePreview()
+{
+    previewGPA.reset();
+
+    auto size = GPAstrain->getSize();
+    if (std::max(size.x, size.y) <= previewSize)
+        return;
+
+    // binning the image and planning the preview's FFTs takes a while on big images
+    auto preview = std::make_shared<std::unique_ptr<GPA>>();
+    int maxSize = previewSize;
+
+    startJob("Making preview", [this, preview, maxSize](UtilsJobs::Progress &)
+    {
+        try
+        {
+            *preview = std::make_unique<GPA>(GPAstrain->getPreviewImage(maxSize));
+        }
+        catch (const std::exception&)
+        {
+            // everything can still be done on the full image
+            preview->reset();
+        }
+    }, [this, preview]()
+    {
+        previewGPA = std::move(*preview);
+    });
+}
+
+GPA &MainWindow::interactiveGPA()
+{
+    if (previewGPA)
+        return *previewGPA;
+
+    return *GPAstrain;
+}
+
+void MainWindow::dropPreview()
+{
+    if (!previewGPA)
+        return;
+
+    std::vector<Coord2D<double>> gs;
+    for (int p = 0; p < phaseSelection; ++p)
+        gs.push_back(previewGPA->getPhase(p)->getGVectorPixels());
+
+    previewGPA.reset();
+
+    // anything started after this waits for it, so will use the full image's phases
+    double sig = _sig;
+    startJob("Calculating phase", [this, gs, sig](UtilsJobs::Progress &)
+    {
+        for (size_t p = 0; p < gs.size(); ++p)
+            GPAstrain->calculatePhase(static_cast<int>(p), gs[p].x, gs[p].y, sig);
+    });
 }
 
 void MainWindow::on_actionGPA_triggered()
@@ -336,18 +508,31 @@ void MainWindow::on_actionGPA_triggered()
     if (!haveImage)
         return;
 
+    abandonJobs();
+
     DisconnectAll();
     ClearImages();
 
+    // it might have been dropped by the last run
+    if (!previewGPA)
+        updatePreview();
+
     ui->tabWidget->setCurrentIndex(0);
 
     // remove annotation from other, old strain analyses
     ui->fftPlot->clearAllItems();
     ui->fftPlot->replot();
 
-    minGrad = GPAstrain->getGVectors();
+    auto grad = std::make_shared<double>(0.0);
 
-    AcceptGVector();
+    startJob("Estimating mask size", [this, grad](UtilsJobs::Progress &)
+    {
+        *grad = GPAstrain->getGVectors();
+    }, [this, grad]()
+    {
+        minGrad = *grad;
+        AcceptGVector();
+    });
 }
 
 void MainWindow::AcceptGVector()
@@ -467,7 +652,13 @@ void MainWindow::processBraggClick(double x, double y) {
     ui->fftPlot->DrawCircle(x, y, phaseCol, QBrush(phaseCol));
     ui->fftPlot->DrawCircle(x, y, phaseCol, QBrush(Qt::NoBrush), 3*_sig); // assume here that 3sigma is the ask radius.
 
-    GPAstrain->calculatePhase(phaseSelection, x, y, _sig);
+    // the preview is only any use if the spot (and its mask) are in its FFT
+    if (previewGPA)
+    {
+        auto size = previewGPA->getSize();
+        if (std::abs(x) + 3*_sig >= size.x / 2 || std::abs(y) + 3*_sig >= size.y / 2)
+            dropPreview();
+    }
 
     // save these so we could use them later
     if (phaseSelection == 0) {
@@ -476,24 +667,36 @@ void MainWindow::processBraggClick(double x, double y) {
         lastG2 = {x, y};
     }
 
-    Eigen::MatrixXd ph = GPAstrain->getPhase(phaseSelection)->getWrappedPhase();
+    GPA *engine = &interactiveGPA();
+    int phase = phaseSelection;
+    double sig = _sig;
+    auto ph = std::make_shared<Eigen::MatrixXd>();
 
-    try
+    startJob("Calculating phase", [engine, phase, x, y, sig, ph](UtilsJobs::Progress &)
     {
-        ui->imagePlot->SetImage(ph);
-    }
-    catch (const std::exception& e)
+        engine->calculatePhase(phase, x, y, sig);
+        *ph = engine->getPhase(phase)->getWrappedPhase();
+    }, [this, ph]()
     {
-        QMessageBox::critical(nullptr,"Error", e.what());
-        return;
-    }
+        try
+        {
+            ui->imagePlot->SetImage(*ph, !previewGPA);
+            if (previewGPA)
+                ui->imagePlot->SetImageExtent(GPAstrain->getSize().x, GPAstrain->getSize().y);
+        }
+        catch (const std::exception& e)
+        {
+            QMessageBox::critical(nullptr,"Error", e.what());
+            return;
+        }
 
-    auto ret = QMessageBox::information(this, tr("Refine"), tr("Do you want to  refine this g-vector"), QMessageBox::Yes | QMessageBox::No);
+        auto ret = QMessageBox::information(this, tr("Refine"), tr("Do you want to  refine this g-vector"), QMessageBox::Yes | QMessageBox::No);
 
-    if (ret == QMessageBox::Yes)
-        selectRefineArea();
-    else
-        continuePhase();
+        if (ret == QMessageBox::Yes)
+            selectRefineArea();
+        else
+            continuePhase();
+    });
 }
 
 
@@ -531,6 +734,10 @@ void MainWindow::continuePhase()
             connect(ui->fftPlot, SIGNAL(mousePress(QMouseEvent * )), this, SLOT(clickBraggSpot(QMouseEvent * )));
         }
     }
+    else if (previewGPA)
+    {
+        startFullResolution();
+    }
     else
     {
         getStrains();
@@ -633,40 +840,63 @@ void MainWindow::clickRectCorner(QMouseEvent *event)
 
 void MainWindow::doRefinement(double top, double left, double bottom, double right)
 {
-    int rowmid = static_cast<int>(GPAstrain->getImage()->rows() / 2);
-    int colmid = static_cast<int>(GPAstrain->getImage()->cols() / 2);
+    // the area is in the pixels of the full image, the preview's are bigger
+    GPA &engine = interactiveGPA();
+    double scaleX = static_cast<double>(engine.getSize().x) / GPAstrain->getSize().x;
+    double scaleY = static_cast<double>(engine.getSize().y) / GPAstrain->getSize().y;
+
+    int rowmid = engine.getSize().y / 2;
+    int colmid = engine.getSize().x / 2;
+
+    int t = static_cast<int>(top * scaleY) + rowmid;
+    int b = static_cast<int>(bottom * scaleY) + rowmid;
+    int l = static_cast<int>(left * scaleX) + colmid;
+    int r = static_cast<int>(right * scaleX) + colmid;
 
-    int t = static_cast<int>(top) + rowmid;
-    int b = static_cast<int>(bottom) + rowmid;
-    int l = static_cast<int>(left) + colmid;
-    int r = static_cast<int>(right) + colmid;
+    GPA *target = &engine;
+    int phase = phaseSelection;
+    auto ph = std::make_shared<Eigen::MatrixXd>();
 
-    GPAstrain->getPhase(phaseSelection)->refinePhase(t, l, b, r);
+    startJob("Refining g-vector", [target, phase, t, l, b, r, ph](UtilsJobs::Progress &)
+    {
+        target->getPhase(phase)->refinePhase(t, l, b, r);
+        *ph = target->getPhase(phase)->getWrappedPhase();
+    }, [this, target, ph]()
+    {
+        showRefinement(*target, *ph);
+    }, [this]()
+    {
+        // e.g. the area was too small, so let another be picked
+        selectRefineArea();
+    });
+}
 
+void MainWindow::showRefinement(GPA &engine, const Eigen::MatrixXd &ph)
+{
     ui->fftPlot->clearAllItems();
 
     if (phaseSelection == 0)
     {
-        auto GVecPx = GPAstrain->getPhase(phaseSelection)->getGVectorPixels();
+        auto GVecPx = engine.getPhase(phaseSelection)->getGVectorPixels();
         ui->fftPlot->DrawCircle(GVecPx.x, GVecPx.y, Qt::red, QBrush(Qt::red));
         ui->fftPlot->DrawCircle(GVecPx.x, GVecPx.y, Qt::red, QBrush(Qt::NoBrush), 3*_sig);
     }
     else
     {
-        auto GVecPx1 = GPAstrain->getPhase(0)->getGVectorPixels();
+        auto GVecPx1 = engine.getPhase(0)->getGVectorPixels();
         ui->fftPlot->DrawCircle(GVecPx1.x, GVecPx1.y, Qt::red, QBrush(Qt::red));
         ui->fftPlot->DrawCircle(GVecPx1.x, GVecPx1.y, Qt::red, QBrush(Qt::NoBrush), 3*_sig);
 
-        auto GVecPx2 = GPAstrain->getPhase(phaseSelection)->getGVectorPixels();
+        auto GVecPx2 = engine.getPhase(phaseSelection)->getGVectorPixels();
         ui->fftPlot->DrawCircle(GVecPx2.x, GVecPx2.y, Qt::blue, QBrush(Qt::blue));
         ui->fftPlot->DrawCircle(GVecPx2.x, GVecPx2.y, Qt::blue, QBrush(Qt::NoBrush), 3*_sig);
     }
 
-    Eigen::MatrixXd ph = GPAstrain->getPhase(phaseSelection)->getWrappedPhase();
-
     try
     {
-        ui->imagePlot->SetImage(ph);
+        ui->imagePlot->SetImage(ph, !previewGPA);
+        if (previewGPA)
+            ui->imagePlot->SetImageExtent(GPAstrain->getSize().x, GPAstrain->getSize().y);
     }
     catch (const std::exception& e)
     {
@@ -688,42 +918,72 @@ void MainWindow::doRefinement(double top, double left, double bottom, double rig
     }
 }
 
-// probably poorly named since it does so much more
 void MainWindow::getStrains(bool showTab, bool rePlot)
+{
+    double angle = ui->angleSpin->value();
+    std::string mode = ui->resultModeBox->currentText().toStdString();
+
+    startJob("Calculating strains", [this, angle, mode](UtilsJobs::Progress &)
+    {
+        GPAstrain->calculateDistortion(angle, mode);
+    }, [this, mode, showTab, rePlot]()
+    {
+        showStrains(mode, showTab, rePlot);
+    });
+}
+
+// probably poorly named since it does so much more
+void MainWindow::showStrains(const std::string &mode, bool showTab, bool rePlot)
 {
     updateStatusBar("GPA completed!");
 
     if (showTab)
         ui->tabWidget->setCurrentIndex(1);
 
-    double angle = ui->angleSpin->value();
-    std::string mode = ui->resultModeBox->currentText().toStdString();
+    showDistortion(*GPAstrain, mode, rePlot);
+
+    haveStrains = true;
 
-    GPAstrain->calculateDistortion(angle, mode);
+    updateOtherPlot(ui->leftCombo->currentIndex(), 0, rePlot);
+    updateOtherPlot(ui->rightCombo->currentIndex(), 1, rePlot);
+
+    ui->menuExportAll->setEnabled(true);
+    ui->menuExportStrains->setEnabled(true);
+}
 
+void MainWindow::showDistortion(GPA &engine, const std::string &mode, bool rePlot)
+{
     if (mode == "Distortion" || mode == "Strain")
     {
-        ui->exxPlot->SetImage(*(GPAstrain->getExx()), false);
-        ui->exyPlot->SetImage(*(GPAstrain->getExy()), false);
-        ui->eyxPlot->SetImage(*(GPAstrain->getEyx()), false);
-        ui->eyyPlot->SetImage(*(GPAstrain->getEyy()), false);
+        ui->exxPlot->SetImage(*(engine.getExx()), false);
+        ui->exyPlot->SetImage(*(engine.getExy()), false);
+        ui->eyxPlot->SetImage(*(engine.getEyx()), false);
+        ui->eyyPlot->SetImage(*(engine.getEyy()), false);
     }
     else if (mode == "Rotation")
     {
         ui->exxPlot->clearImage();
-        ui->exyPlot->SetImage(*(GPAstrain->getExy()), false);
-        ui->eyxPlot->SetImage(*(GPAstrain->getEyx()), false);
+        ui->exyPlot->SetImage(*(engine.getExy()), false);
+        ui->eyxPlot->SetImage(*(engine.getEyx()), false);
         ui->eyyPlot->clearImage();
     }
     else if (mode == "Dilitation")
     {
-        ui->exxPlot->SetImage(*(GPAstrain->getExx()), false);
+        ui->exxPlot->SetImage(*(engine.getExx()), false);
         ui->exyPlot->clearImage();
         ui->eyxPlot->clearImage();
         ui->eyyPlot->clearImage();
     }
 
-    haveStrains = true;
+    // the preview is smaller than the image, but is shown over the same area (cleared plots ignore this)
+    if (&engine != GPAstrain.get())
+    {
+        auto size = GPAstrain->getSize();
+        ui->exxPlot->SetImageExtent(size.x, size.y, false);
+        ui->exyPlot->SetImageExtent(size.x, size.y, false);
+        ui->eyxPlot->SetImageExtent(size.x, size.y, false);
+        ui->eyyPlot->SetImageExtent(size.x, size.y, false);
+    }
 
     double lim =  ui->colorBar->GetLimits().upper;
 
@@ -732,24 +992,55 @@ void MainWindow::getStrains(bool showTab, bool rePlot)
     QCPColorGradient map = ui->colorBar->GetColorMap();
 
     emit ui->colorBar->mapChanged(map, rePlot);
+}
 
-    updateOtherPlot(ui->leftCombo->currentIndex(), 0, rePlot);
-    updateOtherPlot(ui->rightCombo->currentIndex(), 1, rePlot);
+void MainWindow::startFullResolution()
+{
+    // the FFT pixels are the same size in both, so the g-vectors carry straight over
+    std::vector<Coord2D<double>> gs;
+    for (int p = 0; p < 2; ++p)
+        gs.push_back(previewGPA->getPhase(p)->getGVectorPixels());
 
-    ui->menuExportAll->setEnabled(true);
-    ui->menuExportStrains->setEnabled(true);
+    double angle = ui->angleSpin->value();
+    std::string mode = ui->resultModeBox->currentText().toStdString();
+    double sig = _sig;
+
+    ui->tabWidget->setCurrentIndex(1);
+
+    GPA *preview = previewGPA.get();
+
+    startJob("Calculating preview strains", [preview, angle, mode](UtilsJobs::Progress &)
+    {
+        preview->calculateDistortion(angle, mode);
+    }, [this, preview, mode]()
+    {
+        showDistortion(*preview, mode, true);
+    });
+
+    // the phases are the slow part, the strains are then worked out with whatever the angle and mode are by then
+    // (haveStrains is still false, so changing them does nothing until this is done)
+    startJob("Showing preview, working out the full resolution result", [this, gs, sig](UtilsJobs::Progress &)
+    {
+        for (int p = 0; p < 2; ++p)
+            GPAstrain->calculatePhase(p, gs[p].x, gs[p].y, sig);
+        GPAstrain->computePhases();
+    }, [this]()
+    {
+        getStrains(false);
+    });
 }
 
 void MainWindow::on_leftCombo_currentIndexChanged(int index)
 {
+    // waits for anything using the engine
     if (haveStrains)
-        updateOtherPlot(index, 0);
+        startJob("Updating plot", nullptr, [this, index]() { updateOtherPlot(index, 0); });
 }
 
 void MainWindow::on_rightCombo_currentIndexChanged(int index)
 {
     if (haveStrains)
-        updateOtherPlot(index, 1);
+        startJob("Updating plot", nullptr, [this, index]() { updateOtherPlot(index, 1); });
 }
 
 void MainWindow::updateOtherPlot(int index, int side, bool rePlot)
@@ -777,7 +1068,7 @@ void MainWindow::updateOtherPlot(int index, int side, bool rePlot)
         auto imSize = GPAstrain->getSize();
         Eigen::MatrixXcd dx(imSize.y, imSize.x);
         Eigen::MatrixXcd dy(imSize.y, imSize.x);
-        GPAstrain->getPhase(side)->getDifferential(dx, dy);
+        GPAstrain->getPhase(side)->getDifferential(dx, dy, ui->angleSpin->value());
         if (index == 6)
             image->SetImage(dx, ShowComplex::Real, rePlot);
         else
@@ -829,19 +1120,34 @@ void MainWindow::on_actionHann_triggered()
         }
     }
 
+    abandonJobs();
+
     DisconnectAll();
     ClearImages();
 
-    GPAstrain->setDoHann(ui->actionHann->isChecked());
+    bool hann = ui->actionHann->isChecked();
 
-    showImageAndFFT();
-    ui->tabWidget->setCurrentIndex(0);
+    startJob("Calculating FFT", [this, hann](UtilsJobs::Progress &)
+    {
+        GPAstrain->setDoHann(hann);
+        GPAstrain->getFFTPowerSpectrum();
+    }, [this]()
+    {
+        showImageAndFFT();
+        ui->tabWidget->setCurrentIndex(0);
+    });
 }
 
 void MainWindow::ExportAll(int choice) {
     if (!haveStrains)
         return;
 
+    if (jobsBusy())
+    {
+        QMessageBox::information(this, tr("Export"), tr("Wait for the current calculation to finish first"), QMessageBox::Ok);
+        return;
+    }
+
     QSettings settings;
 
     // get path
@@ -858,23 +1164,14 @@ void MainWindow::ExportAll(int choice) {
     if (original_image.size() > 1)
         reply = QMessageBox::question(this, tr("GPA"), tr("Export for all slices in stack?"), QMessageBox::No | QMessageBox::Yes);
 
-    if (reply == QMessageBox::Yes)
+    if (reply == QMessageBox::Yes && choice != 0)
     {
-        int nw = static_cast<int>(std::floor(std::log10(original_image.size()) + 1));
-
-        // here decide if stack is to be done
-        for (int i = 0; i < original_image.size(); ++i) {
-            GPAstrain->updateImage(original_image[i]);
-            showImageAndFFT(false);
-            getStrains(false, false);
-
-            ExportAllSlice(fileDir, choice, QString::number(i).rightJustified(nw, '0'), i == 0);
-        }
-
-        // reset the current image back to the original visible one
-        GPAstrain->updateImage(original_image[0]);
-        showImageAndFFT(true);
-        getStrains(false);
+        // data exports don't need the plots so can be pipelined
+        ExportStack(fileDir, choice, true);
+    }
+    else if (reply == QMessageBox::Yes)
+    {
+        exportSlices(fileDir, choice, true);
     }
     else
     {
@@ -939,6 +1236,12 @@ void MainWindow::ExportStrains(int choice) {
     if (!haveStrains)
         return;
 
+    if (jobsBusy())
+    {
+        QMessageBox::information(this, tr("Export"), tr("Wait for the current calculation to finish first"), QMessageBox::Ok);
+        return;
+    }
+
     QSettings settings;
 
     // get path
@@ -956,23 +1259,14 @@ void MainWindow::ExportStrains(int choice) {
         reply = QMessageBox::question(this, tr("GPA"), tr("Export for all slices in stack?"), QMessageBox::No | QMessageBox::Yes);
 
 
-    if (reply == QMessageBox::Yes)
+    if (reply == QMessageBox::Yes && choice != 0)
     {
-        int nw = static_cast<int>(std::floor(std::log10(original_image.size()) + 1));
-
-        // here decide if stack is to be done
-        for (int i = 0; i < original_image.size(); ++i) {
-            GPAstrain->updateImage(original_image[i]);
-            showImageAndFFT(false);
-            getStrains(false, false);
-
-            ExportStrainsSlice(fileDir, choice, QString::number(i).rightJustified(nw, '0'), i == 0);
-        }
-
-        // reset the current image back to the original visible one
-        GPAstrain->updateImage(original_image[0]);
-        showImageAndFFT(true);
-        getStrains(false);
+        // data exports don't need the plots so can be pipelined
+        ExportStack(fileDir, choice, false);
+    }
+    else if (reply == QMessageBox::Yes)
+    {
+        exportSlices(fileDir, choice, false);
     }
     else
     {
@@ -1015,6 +1309,128 @@ void MainWindow::ExportStrainsSlice(QString fileDir, int choice, QString prefix,
         ui->colorBar->ExportImage(fileDir, "ColourBar");
 }
 
+void MainWindow::exportSlices(const QString &fileDir, int choice, bool allOutputs, int slice)
+{
+    int count = static_cast<int>(original_image.size());
+    if (slice >= count)
+    {
+        restoreSlice();
+        return;
+    }
+
+    std::string mode = ui->resultModeBox->currentText().toStdString();
+    double angle = ui->angleSpin->value();
+    int nw = static_cast<int>(std::floor(std::log10(count) + 1));
+
+    QString name = "Exporting slice " + QString::number(slice + 1) + " of " + QString::number(count);
+
+    startJob(name, [this, slice, angle, mode](UtilsJobs::Progress &)
+    {
+        GPAstrain->updateImage(original_image[slice]);
+        GPAstrain->getFFTPowerSpectrum();
+        GPAstrain->calculateDistortion(angle, mode);
+    }, [this, fileDir, choice, allOutputs, slice, mode, nw]()
+    {
+        showImageAndFFT(false);
+        showStrains(mode, false, false);
+
+        QString prefix = QString::number(slice).rightJustified(nw, '0');
+        if (allOutputs)
+            ExportAllSlice(fileDir, choice, prefix, slice == 0);
+        else
+            ExportStrainsSlice(fileDir, choice, prefix, slice == 0);
+
+        exportSlices(fileDir, choice, allOutputs, slice + 1);
+    }, [this]()
+    {
+        restoreSlice();
+    });
+}
+
+void MainWindow::restoreSlice()
+{
+    std::string mode = ui->resultModeBox->currentText().toStdString();
+    double angle = ui->angleSpin->value();
+
+    // reset the current image back to the original visible one
+    startJob("Showing the first slice", [this, angle, mode](UtilsJobs::Progress &)
+    {
+        GPAstrain->updateImage(original_image[0]);
+        GPAstrain->getFFTPowerSpectrum();
+        GPAstrain->calculateDistortion(angle, mode);
+    }, [this, mode]()
+    {
+        showImageAndFFT(true);
+        showStrains(mode, false);
+    });
+}
+
+void MainWindow::ExportStack(const QString &fileDir, int choice, bool allOutputs)
+{
+    std::string mode = ui->resultModeBox->currentText().toStdString();
+    double angle = ui->angleSpin->value();
+    bool hann = ui->actionHann->isChecked();
+    double sig = _sig;
+
+    std::vector<Coord2D<double>> gs;
+    for (int p = 0; p < 2; ++p)
+        gs.push_back(GPAstrain->getPhase(p)->getGVectorPixels());
+
+    startJob("Exporting stack", [this, fileDir, choice, allOutputs, mode, angle, hann, sig, gs](UtilsJobs::Progress &progress)
+    {
+        size_t count = original_image.size();
+        int nw = static_cast<int>(std::floor(std::log10(count) + 1));
+
+        // each worker needs its own engine, they are created here as FFTW plans can only be made one at a time
+        // only one worker as the engine is already using all the threads, the gain is from overlapping the writing
+        const int nWorkers = 1;
+        std::vector<std::unique_ptr<GPA>> engines;
+        for (int w = 0; w < nWorkers; ++w)
+        {
+            auto engine = std::make_unique<GPA>(original_image[0]);
+            engine->setDoHann(hann);
+            for (int p = 0; p < 2; ++p)
+                engine->calculatePhase(p, gs[p].x, gs[p].y, sig);
+            engines.push_back(std::move(engine));
+        }
+
+        // the whole stack was already decoded when it was opened, so there is nothing to read ahead here and the frames
+        // are passed along without copying them. The gain is all from writing behind (the CLI reads ahead from the file)
+        // stopping the reader lets everything already started finish
+        auto read = [&](size_t i, const Eigen::MatrixXcd *&frame)
+        {
+            if (progress.isCancelled())
+                return false;
+
+            frame = &original_image[i];
+            return true;
+        };
+
+        auto compute = [&](size_t /*i*/, const Eigen::MatrixXcd *&frame, int w)
+        {
+            GPA &engine = *engines[w];
+            engine.updateImage(*frame);
+            engine.calculateDistortion(angle, mode);
+
+            return StrainOutputs::Collect(engine, mode, allOutputs, angle);
+        };
+
+        auto write = [&](size_t i, StrainOutputs::NamedImages &out)
+        {
+            QString prefix = QString::number(i).rightJustified(nw, '0') + " ";
+            for (auto &o : out)
+                UtilsIO::WriteSelector(QDir(fileDir).filePath(prefix + QString::fromStdString(o.first)).toStdString(), o.second, choice);
+
+            progress.step();
+        };
+
+        progress.setStage("Exporting stack", count);
+
+        UtilsPipeline::StackPipeline<const Eigen::MatrixXcd*, StrainOutputs::NamedImages> pipeline(2, nWorkers);
+        pipeline.run(count, read, compute, write);
+    });
+}
+
 void MainWindow::DisconnectAll()
 {
     // stop current GPA if in progress
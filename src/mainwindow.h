@@ -11,9 +11,13 @@
 
 #include <complex>
 #include <iostream>
+#include <deque>
+#include <functional>
 
 #include <QMainWindow>
 #include <QtWidgets/QLabel>
+#include <QtWidgets/QProgressBar>
+#include <QtWidgets/QPushButton>
 #include <QMessageBox>
 
 #include "fftw3.h"
@@ -21,6 +25,7 @@
 #include <Eigen/Dense>
 
 #include "gpa.h"
+#include "jobs.h"
 
 
 namespace DMRead {
@@ -74,6 +79,8 @@ private slots:
     void ExportStrains(int choice);
     void ExportStrainsSlice(QString fileDir, int choice, QString prefix, bool do_colbar);
 
+    void ExportStack(const QString &fileDir, int choice, bool allOutputs);
+
     void on_actionExportAllIm_triggered() {ExportAll(0);}
     void on_actionExportAllDat_triggered() {ExportAll(1);}
     void on_actionExportAllBin_triggered() {ExportAll(2);}
@@ -85,6 +92,13 @@ private slots:
 
     void on_resultModeBox_currentIndexChanged(const QString &arg1);
 
+    // these are queued from the worker thread, anything for a job that isn't the current one is ignored
+    void jobProgress(int id, QString stage, int done, int total);
+    void jobFinished(int id, QString error, bool cancelled);
+
+    // the cancel button, stops the running job and anything waiting
+    void cancelJobs();
+
 private:
     Ui::MainWindow *ui;
 
@@ -94,6 +108,32 @@ private:
 
     std::unique_ptr<GPA> GPAstrain;
 
+    // Big images get a smaller (binned) copy that the interactive steps are done on, the full image is only done once
+    // the g-vectors are accepted. Null if the image is small enough to use as it is
+    std::unique_ptr<GPA> previewGPA;
+
+    // largest side of the preview
+    const int previewSize = 1024;
+
+    // Anything slow goes on the worker so the GUI keeps going. Jobs run one at a time, and the next doesn't start until
+    // the last one's 'done' has run (on the GUI thread), so only one thing is ever using the engines
+    struct PendingJob
+    {
+        QString name;
+        UtilsJobs::Worker::Function work;
+        std::function<void()> done, stopped;
+    };
+
+    UtilsJobs::Worker worker;
+    std::deque<PendingJob> pendingJobs;
+    PendingJob currentJobInfo;
+    UtilsJobs::Job currentJob;
+    int currentJobId = 0;
+    bool jobRunning = false;
+
+    QProgressBar *jobProgressBar;
+    QPushButton *cancelButton;
+
     QString dialogPath;
 
     std::vector<double> xCorner, yCorner;
@@ -113,6 +153,18 @@ private:
 
     void updateStatusBar(QString message);
 
+    // 'work' is run on the worker, then 'done' on the GUI thread if it finished or 'stopped' if it was cancelled or
+    // failed. Without any work, 'done' just waits for everything before it
+    void startJob(const QString &name, UtilsJobs::Worker::Function work, std::function<void()> done = nullptr,
+                  std::function<void()> stopped = nullptr);
+
+    void runNextJob();
+
+    // for when everything is about to be thrown away (e.g. a new image), waits for the running job to stop
+    void abandonJobs();
+
+    bool jobsBusy() const {return jobRunning || !pendingJobs.empty();}
+
 #ifdef _WIN32
     bool openTIFF(std::wstring filename);
 #endif
@@ -125,46 +177,6 @@ private:
 
     void ClearImages();
 
-    template <typename T>
-    void readTiffData(TIFF* tif)
-    {
-        int i = 0;
-        std::vector<Eigen::MatrixXcd> complexImage;
-
-        do {
-            uint32 imagelength;
-            tsize_t scanline;
-            tdata_t buf;
-
-            TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &imagelength);
-            scanline = TIFFScanlineSize(tif);
-            buf = _TIFFmalloc(scanline);
-
-            complexImage.push_back(Eigen::MatrixXcd(imagelength, scanline / sizeof(T)));
-
-            // image too small to differentiate
-            if (imagelength < 3 || scanline / sizeof(T) < 3) {
-                QMessageBox::information(this, tr("File open"), tr("Image too small."), QMessageBox::Ok);
-                return;
-            }
-
-            for (uint32 row = 0; row < imagelength; ++row) {
-                TIFFReadScanline(tif, buf, row);
-                for (uint32 col = 0; col < scanline; ++col) // remember this is in bytes
-                {
-                    T *data = (T *) buf;
-                    complexImage[i](row, col / sizeof(T)) = static_cast<double>(data[col / sizeof(T)]);
-                }
-            }
-
-            _TIFFfree(buf);
-
-            complexImage[i] = complexImage[i].colwise().reverse().eval();
-            ++i;
-        } while (TIFFReadDirectory(tif));
-        original_image = complexImage;
-    }
-
 #ifdef _WIN32
     bool openDM(std::wstring filename);
 #endif
@@ -175,14 +187,40 @@ private:
 
     void showImageAndFFT(bool rePlot = true);
 
+    void updatePreview();
+
+    // the engine the g-vectors are picked and refined on (the preview if there is one)
+    GPA &interactiveGPA();
+
+    // stops using the preview (e.g. for a g-vector outside of it), anything already done on it is copied over
+    void dropPreview();
+
+    // passes the g-vectors from the preview to the full image, shows the preview results and starts on the full ones
+    void startFullResolution();
+
+    // shows the distortion from 'engine' in the strain plots, over the area of the full image
+    void showDistortion(GPA &engine, const std::string &mode, bool rePlot);
+
     void selectRefineArea();
 
     void doRefinement(double top, double left, double bottom, double right);
 
+    // shows the refined g-vectors and phase, then asks if it should be done again
+    void showRefinement(GPA &engine, const Eigen::MatrixXd &ph);
+
     void continuePhase();
 
+    // works out the strains in the background, then shows them
     void getStrains(bool showTab = true, bool rePlot = true);
 
+    void showStrains(const std::string &mode, bool showTab = true, bool rePlot = true);
+
+    // the plot exports need each slice shown in turn, so they are done one job per slice
+    void exportSlices(const QString &fileDir, int choice, bool allOutputs, int slice = 0);
+
+    // back to the first slice after exporting a stack
+    void restoreSlice();
+
     void updateOtherPlot(int index, int side, bool rePlot = true);
 
     void AcceptGVector();